@@ -0,0 +1,66 @@
+; fills all 64 addresses, the PC wraps from 63 to 0 so the last line never runs
+;    
+start:  not r1 r2        ; r1 contains 255
+        add r1 r1 r1     ; r1 contains 254
+        not r1 r1        ; not 254 = 1
+        add r0 r0 r1     ; r0 goes up by 60 every pass
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+        add r0 r0 r1
+last:   not r0 r0        ; address 63, skipped by the wrap
\ No newline at end of file
@@ -0,0 +1,1653 @@
+/** 
+ * FISC Assembler library
+ * 
+ * Parser, label map, encoder and the two pass Assembler behind fiscas, in namespace fiscas.
+ * Header only: fiscas.cpp builds the command line assembler on top of it and
+ * fiscsim includes it to assemble sources in memory (--asm).
+*/
+
+#ifndef FISCAS_H
+#define FISCAS_H
+
+// Imports
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <optional>
+#include <iomanip>
+#include <string_view>
+#include <unordered_map>
+#include <deque>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <set>
+#include <map>
+#include <tuple>
+#include <cstring>
+
+#include "fiscisa.h"
+
+namespace fiscas{
+
+/**
+ * Instruction struct seperating components of one instruction line
+ * 
+ * All text fields are views into the line that was parsed, so parsing never copies it
+ * Only used while a line is processed, the Assembler keeps the compact InstructionText instead
+ * 
+ * Ex: 
+ *      loop:   and r3 r0 r0    ; r3 now has zero
+ * 
+ *      label: "loop"
+ *      cleanInstruction: "and r3 r0 r0"
+ *      tokens: ["and", "r3", "r0", "r0"], tokenCount: 4
+ */
+struct Instruction{
+    static const int MAX_TOKENS = 4;
+
+    int address = 0;
+    std::string_view label;
+    std::string_view cleanInstruction;
+    std::string_view tokens[MAX_TOKENS];
+    int tokenCount = 0;
+};
+
+/**
+ * Cleaned text of every instruction of a program, without labels, comments or surrounding blanks
+ * 
+ * The texts are stored back to back in one arena, instruction k is arena[starts[k], starts[k + 1]),
+ * so an instruction costs its text plus 4 bytes, and the source file itself does not have to stay in memory
+ * Ex: "not r0 r1and r0 r0 r1" with starts [0, 9, 21]
+ */
+struct InstructionText{
+    std::string arena;
+    std::vector<std::uint32_t> starts = {0};
+
+    /**
+     * Appends the text of the next instruction
+     * 
+     * @param text - cleaned instruction
+     */
+    void push_back(std::string_view text){
+        if(arena.size() + text.size() > UINT32_MAX){
+            throw ("ERR: Source file too large.");
+        }
+        arena.append(text);
+        starts.push_back((std::uint32_t)arena.size());
+    }
+
+    /**
+     * @return The number of instructions
+     */
+    size_t size() const{
+        return starts.size() - 1;
+    }
+
+    /**
+     * @param k - address of the instruction
+     * @return Its cleaned text
+     */
+    std::string_view operator[](size_t k) const{
+        return std::string_view(arena).substr(starts[k], starts[k + 1] - starts[k]);
+    }
+
+    void clear(){
+        arena.clear();
+        starts.assign(1, 0);
+    }
+};
+
+/**
+ * Stores labels for specific instructions
+ * 
+ * Lookups go through a hash index keyed by string_view
+ * The labels themselves are kept in insertion order for the [-l] listing,
+ * in a deque so the names the index points at never move
+ */
+struct LabelAddressMap{
+    std::deque<std::pair<std::string, int>> labelAddressMap;
+    std::unordered_map<std::string_view, int> index;
+
+    LabelAddressMap() = default;
+
+    LabelAddressMap(const LabelAddressMap &other){
+        *this = other;
+    }
+
+    LabelAddressMap &operator=(const LabelAddressMap &other){
+        if(this != &other){
+            labelAddressMap.clear();
+            index.clear();
+            for(const auto &label: other.labelAddressMap){
+                insert(label.first, label.second);
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * Inserts label name and line number
+     * If the label is already in the map, lookups keep returning the first address
+     * 
+     * @param label - Label name as a string
+     * @param address - The address that the label points to
+     */
+    void insert(std::string_view label, int address){
+        labelAddressMap.emplace_back(std::string(label), address);
+        index.emplace(labelAddressMap.back().first, address);
+    }
+
+    /**
+     * Returns address corresponding to label
+     * 
+     * @param label - Label string
+     * @return Address of label or error
+     */
+    int find(std::string_view label) const{
+        auto found = index.find(label);
+        if(found == index.end()){
+            throw ("ERR: Label not found");
+        }
+        return found->second;
+    }
+
+    /**
+     * Moves every label to a new address
+     * 
+     * @param newAddress - new address for each old address
+     */
+    void remap(const std::vector<int> &newAddress){
+        for(auto &label: labelAddressMap){
+            label.second = newAddress[label.second];
+        }
+        for(auto &label: index){
+            label.second = newAddress[label.second];
+        }
+    }
+
+    /**
+     * Removes every label so the map can be reused for another program
+     */
+    void clear(){
+        index.clear();
+        labelAddressMap.clear();
+    }
+
+    /**
+     * Check if label exists in the map
+     * @param label - Label string
+     * @return True/False if label exists in map
+     */
+    bool labelExists(std::string_view label) const{
+        return index.count(label) != 0;
+    }
+};
+
+// Parses the instruction into Instruction objects
+class Parser{
+    private:
+    int address = 0;
+
+    public:
+    // Bytes read from a stream at a time
+    static const size_t READ_CHUNK = 1 << 16;
+
+    private:
+    /**
+     * Returns whether the character separates tokens
+     * Carriage returns count as blanks so CRLF sources parse the same
+     */
+    static bool isBlank(char c){
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    public:
+    /**
+     * Reads the whole file into one buffer
+     * 
+     * @param filename - name of file to be read
+     * @return Contents of the file
+     */
+    std::string readFile(std::string filename){
+        std::ifstream myfile(filename, std::ios::binary | std::ios::ate);
+        if (!myfile.good()){
+            throw ("ERR: Cannot open file.");
+        }
+        std::string source;
+        source.resize((size_t)myfile.tellg());
+        myfile.seekg(0);
+        myfile.read(&source[0], source.size());
+        return source;
+    }
+
+    /**
+     * Reads a stream in fixed-size chunks and passes every line to onLine, without its newline
+     * Only a line that is split between two chunks is copied
+     * 
+     * @param in - stream to read
+     * @param onLine - called with each line
+     * @param onChunk - called with the bytes of each chunk after its complete lines
+     */
+    template<typename OnLine, typename OnChunk>
+    void readChunks(std::istream &in, OnLine onLine, OnChunk onChunk){
+        std::vector<char> chunk(READ_CHUNK);
+        // Start of a line that continues in the next chunk
+        std::string partial;
+        while(in){
+            in.read(chunk.data(), chunk.size());
+            std::string_view text(chunk.data(), (size_t)in.gcount());
+            size_t position = 0;
+            size_t end;
+            while((end = text.find('\n', position)) != std::string_view::npos){
+                if(partial.empty()){
+                    onLine(text.substr(position, end - position));
+                }
+                else{
+                    partial.append(text.substr(position, end - position));
+                    onLine(std::string_view(partial));
+                    partial.clear();
+                }
+                position = end + 1;
+            }
+            partial.append(text.substr(position));
+            onChunk(text);
+        }
+        if(!partial.empty()){
+            onLine(std::string_view(partial));
+        }
+    }
+
+    /**
+     * Gets the next line of the buffer without copying it
+     * 
+     * @param source - buffer returned by readFile
+     * @param position - offset of the next line, advanced past it
+     * @param line - set to the line without its newline
+     * @return False once the buffer is exhausted
+     */
+    bool nextLine(std::string_view source, size_t &position, std::string_view &line){
+        if(position >= source.size()){
+            return false;
+        }
+        size_t end = source.find('\n', position);
+        if(end == std::string_view::npos){
+            end = source.size();
+        }
+        line = source.substr(position, end - position);
+        position = end + 1;
+        return true;
+    }
+
+    /**
+     * Parses each line into an instruction object (label, cleaned instruction and tokens)
+     * 
+     * Walks the line once: the first ':' ends the label, ';' starts the comment,
+     * and any run of spaces or tabs separates tokens
+     * 
+     * @param line - The line of assembly to be parsed into instruction
+     * @return Instruction object
+     */
+    Instruction parseLineIntoInstruction(std::string_view line){
+        Instruction instruction;
+        const size_t none = std::string_view::npos;
+        size_t cleanStart = none;
+        size_t cleanEnd = 0;
+        int tokenCount = 0;
+        bool labelSeen = false;
+
+        size_t i = 0;
+        while(i < line.size()){
+            char c = line[i];
+            if(c == ';'){
+                break;
+            }
+            if(c == ':' && !labelSeen){
+                labelSeen = true;
+                if(cleanStart != none){
+                    instruction.label = line.substr(cleanStart, cleanEnd - cleanStart);
+                }
+                cleanStart = none;
+                tokenCount = 0;
+                i++;
+                continue;
+            }
+            if(isBlank(c)){
+                i++;
+                continue;
+            }
+            size_t tokenStart = i;
+            while(i < line.size() && !isBlank(line[i]) && line[i] != ';' 
+                && (line[i] != ':' || labelSeen)){
+                i++;
+            }
+            if(cleanStart == none){
+                cleanStart = tokenStart;
+            }
+            cleanEnd = i;
+            if(tokenCount < Instruction::MAX_TOKENS){
+                instruction.tokens[tokenCount] = line.substr(tokenStart, i - tokenStart);
+            }
+            tokenCount++;
+        }
+
+        if(cleanStart != none){
+            instruction.cleanInstruction = line.substr(cleanStart, cleanEnd - cleanStart);
+        }
+        if(tokenCount > Instruction::MAX_TOKENS){
+            throw ("ERR: Too many operands.");
+        }
+        instruction.tokenCount = tokenCount;
+        instruction.address = address;
+        if(instruction.cleanInstruction.length() != 0){
+            address += 1;
+        }
+        return instruction;
+    }
+
+    /**
+     * Splits an instruction cleaned by parseLineIntoInstruction into its tokens again
+     * The text has no label or comment left, so only blanks separate tokens
+     * 
+     * @param text - cleaned instruction
+     * @return Instruction with the tokens, without label or address
+     */
+    static Instruction tokenize(std::string_view text){
+        Instruction instruction;
+        instruction.cleanInstruction = text;
+        size_t i = 0;
+        while(i < text.size()){
+            if(isBlank(text[i])){
+                i++;
+                continue;
+            }
+            size_t tokenStart = i;
+            while(i < text.size() && !isBlank(text[i])){
+                i++;
+            }
+            if(instruction.tokenCount < Instruction::MAX_TOKENS){
+                instruction.tokens[instruction.tokenCount] = text.substr(tokenStart, i - tokenStart);
+            }
+            instruction.tokenCount++;
+        }
+        return instruction;
+    }
+};
+
+// Builds output of converting instruction to hex
+class OutputBuilder{
+    private:
+    const LabelAddressMap &labelAddressMap;
+
+    public:
+    // Smallest number of instructions worth encoding on a thread of its own
+    static const size_t PARALLEL_CHUNK = 1 << 16;
+
+    OutputBuilder(const LabelAddressMap &map):
+        labelAddressMap(map){}
+
+    /**
+     * Converts the instruction to decimal values
+     * 
+     * Looks the mnemonic up in the instruction set table, checks the operand count
+     * and encodes the registers (or the label address for bnz) with fiscisa::encode
+     * 
+     * @param instruction - parsed instruction with its tokens
+     * @return The decimal value that represents the instruction
+     */
+    int instructionToDecimal(const Instruction &instruction){
+        const std::string_view *parts = instruction.tokens;
+        int opCode = fiscisa::lookupMnemonic(parts[0]);
+        if(opCode < 0){
+            throw ("ERR: Invalid opCode/register.");
+        }
+        if(instruction.tokenCount != fiscisa::operandCount(opCode) + 1){
+            throw ("ERR: Wrong number of operands.");
+        }
+        if(opCode == fiscisa::BNZ){
+            return fiscisa::encodeBranch(labelAddressMap.find(parts[1]));
+        }
+        int destination = registerFromName(parts[1]);
+        int source1 = registerFromName(parts[2]);
+        int source2 = opCode == fiscisa::NOT ? 0 : registerFromName(parts[3]);
+        return fiscisa::encode(opCode, destination, source1, source2);
+    }
+
+    /**
+     * Return the register number for a register name (r0-r3)
+     * 
+     * @param name - register name
+     * @return Value representing the register
+     */
+    int registerFromName(std::string_view name){
+        int reg = fiscisa::lookupRegister(name);
+        if(reg < 0){
+            throw ("ERR: Invalid opCode/register.");
+        }
+        return reg;
+    }
+
+    /**
+     * Encodes a range of instructions and formats their hex lines
+     * Each instruction is split into tokens again from its cleaned text
+     * 
+     * @param instructions - cleaned text of the instructions
+     * @param encodings - receives the encoding of each instruction of the range
+     * @param first - first instruction of the range
+     * @param last - end of the range (exclusive)
+     * @param text - receives the "XX\n" lines of the range, or nullptr to skip formatting
+     */
+    void encodeRange(const InstructionText &instructions, std::vector<std::uint8_t> &encodings, 
+        size_t first, size_t last, std::string *text){
+        static const char digits[] = "0123456789ABCDEF";
+        if(text){
+            text->reserve(3 * (last - first));
+        }
+        for(size_t k = first; k < last; k++){
+            int encoding = instructionToDecimal(Parser::tokenize(instructions[k]));
+            encodings[k] = (std::uint8_t)encoding;
+            if(text){
+                *text += digits[(encoding >> 4) & 0xF];
+                *text += digits[encoding & 0xF];
+                *text += '\n';
+            }
+        }
+    }
+
+    /**
+     * Encodes every instruction
+     * 
+     * Lines only depend on their own text and the finished label map, so large programs
+     * are split into chunks of at least PARALLEL_CHUNK instructions, one thread per chunk.
+     * Smaller programs are encoded on the calling thread.
+     * Errors are reported for the earliest failing chunk, like a sequential pass would.
+     * 
+     * @param instructions - cleaned text of the instructions
+     * @param encodings - receives one encoding per instruction
+     * @param formatHex - whether to also build the hex text of each chunk
+     * @return Hex text per chunk, in program order (empty strings if formatHex is false)
+     */
+    std::vector<std::string> encodeAll(const InstructionText &instructions, std::vector<std::uint8_t> &encodings,
+        bool formatHex){
+        size_t count = instructions.size();
+        encodings.resize(count);
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t chunks = std::min(threads, (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK);
+        if(chunks <= 1){
+            std::vector<std::string> text(1);
+            encodeRange(instructions, encodings, 0, count, formatHex ? &text[0] : nullptr);
+            return text;
+        }
+
+        std::vector<std::string> text(chunks);
+        std::vector<const char*> errors(chunks, nullptr);
+        std::vector<std::thread> workers;
+        size_t chunkSize = (count + chunks - 1) / chunks;
+        for(size_t c = 0; c < chunks; c++){
+            size_t first = c * chunkSize;
+            size_t last = std::min(count, first + chunkSize);
+            workers.emplace_back([this, &instructions, &encodings, &text, &errors, formatHex, c, first, last](){
+                try{
+                    encodeRange(instructions, encodings, first, last, formatHex ? &text[c] : nullptr);
+                }
+                catch(const char* err){
+                    errors[c] = err;
+                }
+            });
+        }
+        for(std::thread &worker: workers){
+            worker.join();
+        }
+        for(const char *err: errors){
+            if(err){
+                throw err;
+            }
+        }
+        return text;
+    }
+
+    /**
+     * Writes the hex text built by encodeAll to the output file
+     * 
+     * @param file - output file to write to
+     * @param chunks - hex text of each chunk, in program order
+     */
+    void writeToFile(std::string file, const std::vector<std::string> &chunks){
+        static const char header[] = "v2.0 raw\n";
+        std::ofstream outputfile (file, std::ios::binary);
+        outputfile.write(header, sizeof(header) - 1);
+        for(const std::string &text: chunks){
+            outputfile.write(text.data(), text.size());
+        }
+        outputfile.close();
+    }
+
+    /**
+     * Rewrites selected instructions of an existing "v2.0 raw" file in place
+     * Line k of the program is the two hex digits at offset 9 + 3k
+     * 
+     * @param file - hex file written by an earlier run for a program of the same length
+     * @param encodings - encoding of each instruction
+     * @param changed - indexes of the instructions to rewrite
+     */
+    void patchHexFile(std::string file, const std::vector<std::uint8_t> &encodings, const std::vector<size_t> &changed){
+        static const char digits[] = "0123456789ABCDEF";
+        std::fstream outputfile (file, std::ios::in | std::ios::out | std::ios::binary);
+        for(size_t k: changed){
+            char hex[2] = {digits[(encodings[k] >> 4) & 0xF], digits[encodings[k] & 0xF]};
+            outputfile.seekp(9 + 3 * k);
+            outputfile.write(hex, 2);
+        }
+        outputfile.close();
+    }
+
+    /**
+     * Writes the program as a binary object file instead of "v2.0 raw" text
+     * 
+     * Layout (numbers are little endian):
+     *      "FOBJ", version (1 byte), flags (1 byte, bit 0: symbol section follows),
+     *      instruction count (4 bytes), one byte per instruction,
+     *      symbol count (4 bytes), then per symbol: address (4 bytes), name length (2 bytes), name
+     * 
+     * @param file - output file to write to
+     * @param encodings - encoding of each instruction
+     * @param symbols - whether to write the label list as a symbol section
+     */
+    void writeBinaryFile(std::string file, const std::vector<std::uint8_t> &encodings, bool symbols){
+        std::string data = "FOBJ";
+        data += (char)1;
+        data += (char)(symbols ? 1 : 0);
+        appendNumber(data, encodings.size(), 4);
+        data.append(encodings.begin(), encodings.end());
+        if(symbols){
+            appendNumber(data, labelAddressMap.labelAddressMap.size(), 4);
+            for(const auto &label: labelAddressMap.labelAddressMap){
+                appendNumber(data, label.second, 4);
+                appendNumber(data, label.first.size(), 2);
+                data += label.first;
+            }
+        }
+        std::ofstream outputfile (file, std::ios::binary);
+        outputfile.write(data.data(), data.size());
+        outputfile.close();
+    }
+
+    /**
+     * Appends a little endian number
+     * 
+     * @param data - bytes to append to
+     * @param value - number to append
+     * @param bytes - number of bytes to use
+     */
+    void appendNumber(std::string &data, size_t value, int bytes){
+        for(int b = 0; b < bytes; b++){
+            data += (char)((value >> (8 * b)) & 0xFF);
+        }
+    }
+
+    /**
+     * If the user uses the [-l] flag, output the information to the command line
+     * 
+     * Outputs the label list and the address that corresponds to each label
+     * Outputs the machine program with the address, hex instruction, and string instructino
+     * Note instructions are converted to hex with std::hex
+     * 
+     * @param instructions - cleaned text of the instructions
+     * @param encodings - encoding of each instruction
+     * @param out - stream to print to
+     */
+    void printListTable(const InstructionText &instructions, const std::vector<std::uint8_t> &encodings, 
+        std::ostream &out){
+        out << "*** LABEL LIST ***" << std::endl;
+        for (auto label: labelAddressMap.labelAddressMap){
+            out << label.first << '\t';
+            out << std::uppercase << std::setw(2) << std::setfill('0');
+            out << std::hex << label.second << std::endl;
+        }
+        out << "*** MACHINE PROGRAM ***" << std::endl;
+        for(size_t k = 0; k < instructions.size(); k++){
+            out << std::hex << std::uppercase << std::setw(2) 
+                << std::setfill('0') << k << ":";
+            out << std::hex << std::uppercase << std::setw(2) 
+                << std::setfill('0') << (int)encodings[k] << '\t';
+            out << instructions[k] << std::endl;
+        }
+    }
+};
+
+/**
+ * Peephole optimizer run between pass one and pass two ([-O])
+ * 
+ * Works on one basic block at a time. A block starts at address 0, at a bnz target and after a bnz,
+ * so nothing is known about the registers or the Z flag when a block starts.
+ * Within a block every register and the Z flag are tracked as value numbers (local value numbering,
+ * with and x x = x and not not x = x), then a backward liveness scan finds the writes nobody reads.
+ * 
+ *      - An instruction whose register and Z flag already hold its result is removed
+ *        Ex: and r3 r0 r0 followed by and r3 r3 r3
+ *      - A not that computes a value already held by another register becomes a copy of it,
+ *        when that lets the instruction it read from be removed
+ *        Ex: not r0 r1, not r0 r0 becomes and r0 r1 r1
+ *      - A write that is overwritten in the block before it is read is removed
+ *        (every register and Z are live when a block ends)
+ *      - A bnz to the next instruction is removed
+ * 
+ * This repeats until nothing changes. Labels move to the next instruction that is left.
+ * Only programs of at most 62 instructions are changed: the simulator never runs address 63
+ * and wraps to 0 instead, so moving instructions of a longer program would change what runs.
+ */
+class Optimizer{
+    private:
+    // Largest program the optimizer changes
+    static const size_t MAX_INSTRUCTIONS = 62;
+
+    struct Operation{
+        int opCode;
+        int destination;
+        int source1;
+        int source2;
+        // Branch address of a bnz
+        int target;
+        // Address before the optimizer ran
+        size_t original;
+        std::string text;
+    };
+
+    std::vector<Operation> program;
+    std::vector<std::string> changes;
+
+    /**
+     * Formats an original address like the listing does
+     */
+    static std::string hexAddress(size_t address){
+        std::ostringstream text;
+        text << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << address;
+        return text.str();
+    }
+
+    /**
+     * Records a change for the listing
+     */
+    void note(const Operation &o, const std::string &what){
+        changes.push_back(hexAddress(o.original) + '\t' + o.text + '\t' + what);
+    }
+
+    /**
+     * Optimizes the block [first, last)
+     * 
+     * @param first - first instruction of the block
+     * @param last - end of the block (exclusive)
+     * @param removed - set for every instruction to remove
+     * @return True if anything changed
+     */
+    bool optimizeBlock(size_t first, size_t last, std::vector<bool> &removed){
+        // Value number held by each register and by the Z flag (Z is set when that value is zero)
+        int value[4];
+        int zValue = -1;
+        int next = 0;
+        for(int r = 0; r < 4; r++){
+            value[r] = next++;
+        }
+        // Instruction of the block that last wrote each register, -1 if it was written before the block
+        long writer[4] = {-1, -1, -1, -1};
+        std::map<std::tuple<int, int, int>, int> known;
+        std::unordered_map<int, int> complement;
+        // not instructions turned into copies, with the instruction they no longer read from
+        std::vector<std::pair<size_t, long>> copies;
+        std::vector<int> copySource(last - first, -1);
+        bool changed = false;
+
+        for(size_t k = first; k < last; k++){
+            Operation &o = program[k];
+            if(o.opCode == fiscisa::BNZ){
+                if(o.target == (int)k + 1){
+                    note(o, "removed, branches to the next instruction");
+                    removed[k] = true;
+                    changed = true;
+                }
+                continue;
+            }
+            int a = value[o.source1];
+            int b = value[o.source2];
+            int result;
+            if(o.opCode == fiscisa::NOT){
+                auto found = complement.find(a);
+                if(found != complement.end()){
+                    result = found->second;
+                }
+                else{
+                    result = next++;
+                    complement[a] = result;
+                    complement[result] = a;
+                }
+            }
+            else if(o.opCode == fiscisa::AND && a == b){
+                result = a;
+            }
+            else{
+                auto key = std::make_tuple(o.opCode, std::min(a, b), std::max(a, b));
+                auto found = known.find(key);
+                result = found != known.end() ? found->second : (known[key] = next++);
+            }
+
+            if(value[o.destination] == result && zValue == result){
+                note(o, "removed, register and Z flag already hold the result");
+                removed[k] = true;
+                changed = true;
+                continue;
+            }
+            if(o.opCode == fiscisa::NOT){
+                for(int r = 0; r < 4; r++){
+                    if(value[r] == result){
+                        copies.emplace_back(k, writer[o.source1]);
+                        copySource[k - first] = r;
+                        break;
+                    }
+                }
+            }
+            value[o.destination] = result;
+            zValue = result;
+            writer[o.destination] = (long)k;
+        }
+
+        // Backward liveness, instructions turned into copies read their new source
+        bool live[4] = {true, true, true, true};
+        bool zLive = true;
+        for(size_t k = last; k-- > first;){
+            if(removed[k]){
+                continue;
+            }
+            const Operation &o = program[k];
+            if(o.opCode == fiscisa::BNZ){
+                zLive = true;
+                continue;
+            }
+            if(!live[o.destination] && !zLive){
+                note(o, "removed, result is overwritten before it is read");
+                removed[k] = true;
+                changed = true;
+                continue;
+            }
+            live[o.destination] = false;
+            zLive = false;
+            if(copySource[k - first] >= 0){
+                live[copySource[k - first]] = true;
+            }
+            else{
+                live[o.source1] = true;
+                live[o.source2] |= o.opCode != fiscisa::NOT;
+            }
+        }
+
+        // Keep a copy only if the instruction it bypassed was removed
+        for(const auto &copy: copies){
+            if(copy.second < 0 || !removed[copy.second] || removed[copy.first]){
+                continue;
+            }
+            Operation &o = program[copy.first];
+            int source = copySource[copy.first - first];
+            std::string text = "and r" + std::to_string(o.destination) + " r" + std::to_string(source) 
+                + " r" + std::to_string(source);
+            note(o, "becomes " + text);
+            o = Operation{fiscisa::AND, o.destination, source, source, 0, o.original, text};
+            changed = true;
+        }
+        return changed;
+    }
+
+    /**
+     * Runs every block once and removes what they dropped
+     * 
+     * @param newAddress - updated with where each address moved
+     * @return True if anything changed
+     */
+    bool optimizeOnce(std::vector<int> &newAddress){
+        size_t count = program.size();
+        std::vector<bool> leader(count + 1, false);
+        leader[0] = true;
+        for(size_t k = 0; k < count; k++){
+            if(program[k].opCode == fiscisa::BNZ){
+                leader[k + 1] = true;
+                leader[program[k].target] = true;
+            }
+        }
+        std::vector<bool> removed(count, false);
+        bool changed = false;
+        size_t first = 0;
+        for(size_t k = 1; k <= count; k++){
+            if(leader[k] || k == count){
+                changed |= optimizeBlock(first, k, removed);
+                first = k;
+            }
+        }
+        if(!changed){
+            return false;
+        }
+
+        // Address k moves to the first instruction left at or after it
+        std::vector<int> moved(count + 1);
+        std::vector<Operation> kept;
+        for(size_t k = 0; k < count; k++){
+            moved[k] = (int)kept.size();
+            if(!removed[k]){
+                kept.push_back(std::move(program[k]));
+            }
+        }
+        moved[count] = (int)kept.size();
+        for(Operation &o: kept){
+            if(o.opCode == fiscisa::BNZ){
+                o.target = moved[o.target];
+            }
+        }
+        for(int &address: newAddress){
+            address = moved[address];
+        }
+        program = std::move(kept);
+        return true;
+    }
+
+    public:
+    /**
+     * Optimizes a program after pass one
+     * Every instruction is encoded first, so an invalid one reports the same error pass two would
+     * 
+     * @param instructions - cleaned text of the instructions, replaced by the optimized program
+     * @param labelAddressMap - labels, moved to the optimized addresses
+     */
+    void optimize(InstructionText &instructions, LabelAddressMap &labelAddressMap){
+        changes.clear();
+        program.clear();
+        OutputBuilder outputBuilder(labelAddressMap);
+        for(size_t k = 0; k < instructions.size(); k++){
+            Instruction i = Parser::tokenize(instructions[k]);
+            std::uint8_t encoding = (std::uint8_t)outputBuilder.instructionToDecimal(i);
+            int target = fiscisa::opCode(encoding) == fiscisa::BNZ ? labelAddressMap.find(i.tokens[1]) : 0;
+            program.push_back(Operation{fiscisa::opCode(encoding), fiscisa::destination(encoding), 
+                fiscisa::source1(encoding), fiscisa::source2(encoding), target, k, std::string(instructions[k])});
+        }
+        if(program.size() > MAX_INSTRUCTIONS){
+            changes.push_back("none, the program has more than 62 instructions");
+            return;
+        }
+
+        std::vector<int> newAddress(program.size() + 1);
+        for(size_t k = 0; k < newAddress.size(); k++){
+            newAddress[k] = (int)k;
+        }
+        while(optimizeOnce(newAddress)){
+        }
+        if(changes.empty()){
+            changes.push_back("none");
+            return;
+        }
+        std::stable_sort(changes.begin(), changes.end());
+        labelAddressMap.remap(newAddress);
+        instructions.clear();
+        for(const Operation &o: program){
+            instructions.push_back(o.text);
+        }
+    }
+
+    /**
+     * Prints what the optimizer changed, after the [-l] listing
+     * Addresses are the ones before the optimizer ran
+     * 
+     * @param out - stream to print to
+     */
+    void printChanges(std::ostream &out) const{
+        out << "*** OPTIMIZATIONS ***" << std::endl;
+        for(const std::string &change: changes){
+            out << change << std::endl;
+        }
+    }
+};
+
+/**
+ * What the last incremental run produced for one object file, stored in <object file>.cache
+ * 
+ * Layout (numbers are little endian):
+ *      "FCCH", version (1 byte), source hash (8 bytes), object size (8 bytes), object write time (8 bytes),
+ *      instruction count (4 bytes), then per instruction: line hash (8 bytes), encoding (1 byte)
+ * The label map itself is not needed: a bnz whose label moved is found by comparing
+ * the cached branch target with the label's new address
+ */
+struct AssemblyCache{
+    struct Line{
+        std::uint64_t hash;
+        std::uint8_t encoding;
+    };
+
+    std::uint64_t sourceHash = 0;
+    std::uint64_t objectSize = 0;
+    std::int64_t objectTime = 0;
+    std::vector<Line> lines;
+
+    static const std::uint64_t HASH_START = 14695981039346656037ull;
+
+    /**
+     * 64-bit FNV-1a hash
+     * 
+     * @param text - bytes to hash
+     * @param h - hash of the bytes before text, to hash a file chunk by chunk
+     * @return Hash of text
+     */
+    static std::uint64_t hash(std::string_view text, std::uint64_t h = HASH_START){
+        for(char c: text){
+            h = (h ^ (unsigned char)c) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    /**
+     * Gets size and last write time of a file
+     * 
+     * @param file - file to look at
+     * @param size - receives the size
+     * @param time - receives the last write time
+     * @return False if the file cannot be read
+     */
+    static bool stamp(const std::string &file, std::uint64_t &size, std::int64_t &time){
+        std::error_code error;
+        size = std::filesystem::file_size(file, error);
+        if(error){
+            return false;
+        }
+        time = std::filesystem::last_write_time(file, error).time_since_epoch().count();
+        return !error;
+    }
+
+    /**
+     * Reads a cache file
+     * 
+     * @param file - cache file
+     * @return False if there is no usable cache
+     */
+    bool load(const std::string &file){
+        std::ifstream input(file, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        size_t position = 0;
+        if(data.compare(0, 5, std::string("FCCH\x01", 5)) != 0){
+            return false;
+        }
+        position = 5;
+        std::uint64_t count;
+        if(!readNumber(data, position, 8, sourceHash) || !readNumber(data, position, 8, objectSize)
+            || !readNumber(data, position, 8, count)){
+            return false;
+        }
+        objectTime = (std::int64_t)count;
+        if(!readNumber(data, position, 4, count)){
+            return false;
+        }
+        lines.resize(count);
+        for(Line &line: lines){
+            std::uint64_t encoding;
+            if(!readNumber(data, position, 8, line.hash) || !readNumber(data, position, 1, encoding)){
+                return false;
+            }
+            line.encoding = (std::uint8_t)encoding;
+        }
+        return true;
+    }
+
+    /**
+     * Writes the cache for a finished object file
+     * 
+     * @param file - cache file
+     * @param sourceHash - hash of the whole source
+     * @param object - object file that was written
+     * @param lineHashes - hash of each instruction's text
+     * @param encodings - encoding of each instruction
+     */
+    static void save(const std::string &file, std::uint64_t sourceHash, const std::string &object,
+        const std::vector<std::uint64_t> &lineHashes, const std::vector<std::uint8_t> &encodings){
+        std::uint64_t size = 0;
+        std::int64_t time = 0;
+        stamp(object, size, time);
+
+        std::string data("FCCH\x01", 5);
+        appendNumber(data, sourceHash, 8);
+        appendNumber(data, size, 8);
+        appendNumber(data, (std::uint64_t)time, 8);
+        appendNumber(data, encodings.size(), 4);
+        for(size_t k = 0; k < encodings.size(); k++){
+            appendNumber(data, lineHashes[k], 8);
+            appendNumber(data, encodings[k], 1);
+        }
+        std::ofstream output(file, std::ios::binary);
+        output.write(data.data(), data.size());
+    }
+
+    static void appendNumber(std::string &data, std::uint64_t value, int bytes){
+        for(int b = 0; b < bytes; b++){
+            data += (char)((value >> (8 * b)) & 0xFF);
+        }
+    }
+
+    static bool readNumber(const std::string &data, size_t &position, int bytes, std::uint64_t &value){
+        if(position + bytes > data.size()){
+            return false;
+        }
+        value = 0;
+        for(int b = 0; b < bytes; b++){
+            value |= (std::uint64_t)(unsigned char)data[position + b] << (8 * b);
+        }
+        position += bytes;
+        return true;
+    }
+};
+
+class Assembler{
+    private:
+    std::string filename;
+    std::string outputFilename;
+    bool listOutput;
+    bool binaryOutput;
+    bool incremental;
+    bool optimizing;
+
+    // Only the cleaned text of each instruction is kept, pass two splits it into tokens again
+    InstructionText instructions;
+    std::vector<std::uint8_t> encodings;
+    std::uint64_t sourceHash = AssemblyCache::HASH_START;
+    LabelAddressMap labelAddressMap;
+    Optimizer optimizer;
+
+    public:
+    /**
+     * Prints usage info for the program
+     */
+    void printUsageInfo(){
+            std::cout << "USAGE:  fiscas <source file> <object file> [-l] [-b] [-c] [-O]";
+            std::cout << "\n\tfiscas --batch <manifest> [-j threads]";
+            std::cout << "\n\tfiscas --stream <object file> < source";
+            std::cout << "\n\t-l : print listing to standard error";
+            std::cout << "\n\t-b : write a binary object file with a symbol section instead of v2.0 raw";
+            std::cout << "\n\t-c : reassemble incrementally, reusing the encodings saved in <object file>.cache";
+            std::cout << "\n\t-O : remove redundant instructions before encoding, -l shows what changed";
+            std::cout << "\n\t--batch : assemble every \"<source file> <object file> [-l] [-b] [-c] [-O]\" line of the manifest";
+            std::cout << "\n\t\tput a path that contains spaces in double quotes, Ex: \"My Programs/fibo.s\" fibo.hex";
+            std::cout << "\n\t-j : number of files to assemble at once in batch mode (default 1)";
+            std::cout << "\n\t--stream : assemble standard input in one pass, - writes the hex to standard output";
+    }
+
+    /**
+     * Parses and stores command line arguments
+     */
+    void initFromCmdLine(int argc, char *argv[]){
+        if(argc == 1){
+            printUsageInfo();
+        }
+        else if(argc < 3 || argc > 7){
+            printUsageInfo();
+        }
+
+        bool list = false;
+        bool binary = false;
+        bool cache = false;
+        bool optimize = false;
+        for(int i = 3; i < argc; i++){
+            std::string option(argv[i]);
+            if(!option.compare("-l")){
+                list = true;
+            }
+            else if(!option.compare("-b")){
+                binary = true;
+            }
+            else if(!option.compare("-c")){
+                cache = true;
+            }
+            else if(!option.compare("-O")){
+                optimize = true;
+            }
+        }
+        init(argv[1], argv[2], list, binary, cache, optimize);
+    }
+
+    /**
+     * Sets up the assembler for one source/object pair
+     * State left from a previous file is cleared, buffers keep their capacity
+     * 
+     * @param sourceFile - assembly file to read
+     * @param objectFile - object file to write
+     * @param list - print the listing
+     * @param binary - write a binary object file
+     * @param cache - reassemble incrementally with <object file>.cache
+     * @param optimize - run the optimizer between the passes
+     */
+    void init(std::string sourceFile, std::string objectFile, bool list, bool binary, bool cache, 
+        bool optimize = false){
+        filename = std::move(sourceFile);
+        outputFilename = std::move(objectFile);
+        listOutput = list;
+        binaryOutput = binary;
+        incremental = cache;
+        optimizing = optimize;
+        instructions.clear();
+        encodings.clear();
+        sourceHash = AssemblyCache::HASH_START;
+        labelAddressMap.clear();
+    }
+
+    /**
+     * Reads the file, processes the instruction, and extract the label/address pairs
+     * The file is read in chunks, so only the cleaned instructions stay in memory
+     */
+    void passOne(){
+        std::ifstream myfile(filename, std::ios::binary);
+        if (!myfile.good()){
+            throw ("ERR: Cannot open file.");
+        }
+        Parser parser;
+        parser.readChunks(myfile, 
+            [this, &parser](std::string_view line){ scanLine(parser, line); },
+            [this](std::string_view chunk){
+                if(incremental){
+                    sourceHash = AssemblyCache::hash(chunk, sourceHash);
+                }
+            });
+    }
+
+    /**
+     * Pass one over a single line
+     * 
+     * @param parser - parser that numbers the instructions
+     * @param line - line of the source, without its newline
+     */
+    void scanLine(Parser &parser, std::string_view line){
+        Instruction result = parser.parseLineIntoInstruction(line);
+        if(result.cleanInstruction.length() == 0 && 
+            result.label.length() != 0){
+                labelAddressMap.insert(result.label, result.address);
+        }
+        if(result.cleanInstruction.length() != 0){
+            if(labelAddressMap.labelExists(result.label)){
+                throw ("ERR: Duplicate labels detected.");
+            }
+            instructions.push_back(result.cleanInstruction);
+            if(result.label.length()!=0){
+                labelAddressMap.insert(result.label, result.address);
+            }
+        }
+    }
+
+    /**
+     * Optimizer pass between pass one and pass two, only runs with [-O]
+     * See Optimizer for what it removes
+     */
+    void optimize(){
+        if(optimizing){
+            optimizer.optimize(instructions, labelAddressMap);
+        }
+    }
+
+    /**
+     * Runs both passes on source text without writing an object file
+     * The labels of pass one stay available through getLabels()
+     * 
+     * @param text - assembly source
+     * @return The encoded program, one byte per instruction
+     */
+    std::vector<std::uint8_t> assembleInMemory(std::string text){
+        init("", "", false, false, false);
+        Parser parser;
+        size_t position = 0;
+        std::string_view line;
+        while(parser.nextLine(text, position, line)){
+            scanLine(parser, line);
+        }
+        OutputBuilder outputBuilder(labelAddressMap);
+        outputBuilder.encodeAll(instructions, encodings, false);
+        return encodings;
+    }
+
+    /**
+     * Labels found by the last pass one, in source order
+     */
+    const LabelAddressMap &getLabels() const{
+        return labelAddressMap;
+    }
+
+    /**
+     * Builds the output with the information extracted from pass one
+     * Writes the information to the output file
+     * Print the information to command line if [-l] flag is used
+     * 
+     * @param listing - stream the [-l] listing goes to
+     */
+    void passTwo(std::ostream &listing = std::cout){
+        OutputBuilder outputBuilder(labelAddressMap);
+        if(!incremental || !reassemble(outputBuilder)){
+            writeObject(encodeProgram());
+            if(incremental){
+                saveCache();
+            }
+        }
+        if(listOutput){
+            outputBuilder.printListTable(instructions, encodings, listing);
+            if(optimizing){
+                optimizer.printChanges(listing);
+            }
+        }
+    }
+
+    /**
+     * Encoding half of pass two
+     * 
+     * @return Hex text per chunk, see OutputBuilder::encodeAll
+     */
+    std::vector<std::string> encodeProgram(){
+        OutputBuilder outputBuilder(labelAddressMap);
+        return outputBuilder.encodeAll(instructions, encodings, !binaryOutput);
+    }
+
+    /**
+     * Writing half of pass two
+     * 
+     * @param chunks - hex text returned by encodeProgram
+     */
+    void writeObject(const std::vector<std::string> &chunks){
+        OutputBuilder outputBuilder(labelAddressMap);
+        if(binaryOutput){
+            outputBuilder.writeBinaryFile(outputFilename, encodings, true);
+        }
+        else{
+            outputBuilder.writeToFile(outputFilename, chunks);
+        }
+    }
+
+    /**
+     * Incremental pass two: patches the hex file left by the last run instead of rewriting it
+     * 
+     * Only possible when the cache is readable, the object file is still the one the cache
+     * describes (same size and write time) and the program has the same number of instructions.
+     * A line is re-encoded when its text changed, or when it is a bnz whose label moved.
+     * Every other line reuses its cached encoding and is left untouched in the file.
+     * Reading and hashing the source is still linear, encoding and writing scale with the edit.
+     * 
+     * @param outputBuilder - encoder for the changed lines
+     * @return False if the full pass two has to run instead
+     */
+    bool reassemble(OutputBuilder &outputBuilder){
+        std::string cacheFile = outputFilename + ".cache";
+        AssemblyCache cache;
+        std::uint64_t size;
+        std::int64_t time;
+        if(binaryOutput || !cache.load(cacheFile) || cache.lines.size() != instructions.size()
+            || !AssemblyCache::stamp(outputFilename, size, time)
+            || size != cache.objectSize || time != cache.objectTime
+            || size != 9 + 3 * instructions.size()){
+            return false;
+        }
+
+        encodings.resize(instructions.size());
+        if(sourceHash == cache.sourceHash){
+            for(size_t k = 0; k < instructions.size(); k++){
+                encodings[k] = cache.lines[k].encoding;
+            }
+            return true;
+        }
+
+        std::vector<std::uint64_t> lineHashes(instructions.size());
+        std::vector<size_t> changed;
+        for(size_t k = 0; k < instructions.size(); k++){
+            Instruction i = Parser::tokenize(instructions[k]);
+            lineHashes[k] = AssemblyCache::hash(instructions[k]);
+            bool reuse = lineHashes[k] == cache.lines[k].hash;
+            if(reuse && fiscisa::opCode(cache.lines[k].encoding) == fiscisa::BNZ){
+                reuse = labelAddressMap.labelExists(i.tokens[1]) && fiscisa::branchAddress(cache.lines[k].encoding)
+                    == (labelAddressMap.find(i.tokens[1]) & 63);
+            }
+            if(reuse){
+                encodings[k] = cache.lines[k].encoding;
+            }
+            else{
+                encodings[k] = (std::uint8_t)outputBuilder.instructionToDecimal(i);
+                if(encodings[k] != cache.lines[k].encoding){
+                    changed.push_back(k);
+                }
+            }
+        }
+        outputBuilder.patchHexFile(outputFilename, encodings, changed);
+        saveCache(lineHashes);
+        return true;
+    }
+
+    /**
+     * Writes <object file>.cache for the object file that was just written
+     * The source hash was computed while pass one read the file
+     * 
+     * @param lineHashes - hash of each instruction's text, computed here when empty
+     */
+    void saveCache(std::vector<std::uint64_t> lineHashes = {}){
+        if(lineHashes.empty()){
+            lineHashes.resize(instructions.size());
+            for(size_t k = 0; k < instructions.size(); k++){
+                lineHashes[k] = AssemblyCache::hash(instructions[k]);
+            }
+        }
+        AssemblyCache::save(outputFilename + ".cache", sourceHash, outputFilename,
+            lineHashes, encodings);
+    }
+};
+
+/**
+ * Single pass assembler for piped input
+ * 
+ * Reads the source in chunks and encodes every instruction as soon as it is parsed.
+ * A bnz to a label that has not appeared yet is written as a placeholder and kept in a fixup list
+ * until the label is defined, then its byte is patched.
+ * Into a regular file the placeholder is written right away and patched in place (line k is at offset 9 + 3k),
+ * so memory only grows with the labels. On standard output ("-"), a pipe or a device bytes cannot be patched
+ * once written, so lines from the first unresolved bnz on are held back until it is resolved.
+ * Only "v2.0 raw" hex is written; if the source has an error, what was written before it stays in the output.
+ */
+class StreamingAssembler{
+    private:
+    LabelAddressMap labelAddressMap;
+    // Instructions waiting for each undefined label
+    std::unordered_map<std::string, std::vector<size_t>> fixups;
+    // Indexes of every instruction that still waits for a label, only kept when the output is not seekable
+    std::set<size_t> unresolved;
+    std::ostream *out = nullptr;
+    std::ofstream file;
+    bool seekable = false;
+    // Hex lines held back when the output is not seekable, the first one belongs to instruction heldFrom
+    std::string held;
+    size_t heldFrom = 0;
+    size_t count = 0;
+
+    /**
+     * Formats a byte as a hex line ("XX\n")
+     */
+    static void formatHex(char *text, int value){
+        static const char digits[] = "0123456789ABCDEF";
+        text[0] = digits[(value >> 4) & 0xF];
+        text[1] = digits[value & 0xF];
+        text[2] = '\n';
+    }
+
+    /**
+     * Writes the held lines before the first instruction that still waits for a label
+     */
+    void release(){
+        size_t end = unresolved.empty() ? count : *unresolved.begin();
+        size_t length = 3 * (end - heldFrom);
+        if(length != 0){
+            out->write(held.data(), length);
+            held.erase(0, length);
+            heldFrom = end;
+        }
+    }
+
+    /**
+     * Writes the encoding of one instruction
+     * 
+     * @param value - encoded instruction
+     */
+    void emit(int value){
+        char text[3];
+        formatHex(text, value);
+        if(seekable){
+            file.write(text, 3);
+        }
+        else{
+            held.append(text, 3);
+        }
+        count++;
+    }
+
+    /**
+     * Rewrites an instruction that was waiting for its label
+     * 
+     * @param k - index of the instruction
+     * @param value - its encoding
+     */
+    void patch(size_t k, int value){
+        char text[3];
+        formatHex(text, value);
+        if(seekable){
+            std::streampos end = file.tellp();
+            if(end == std::streampos(-1) || !file.seekp(9 + 3 * k) || !file.write(text, 2) || !file.seekp(end)){
+                throw ("ERR: Cannot write object file.");
+            }
+        }
+        else{
+            memcpy(&held[3 * (k - heldFrom)], text, 2);
+            unresolved.erase(k);
+        }
+    }
+
+    /**
+     * Defines a label and resolves the instructions waiting for it
+     */
+    void defineLabel(std::string_view label, int address){
+        labelAddressMap.insert(label, address);
+        auto waiting = fixups.find(std::string(label));
+        if(waiting == fixups.end()){
+            return;
+        }
+        for(size_t k: waiting->second){
+            patch(k, fiscisa::encodeBranch(address));
+        }
+        fixups.erase(waiting);
+    }
+
+    /**
+     * Assembles one line, with the same rules as the two pass assembler
+     */
+    void assembleLine(Parser &parser, OutputBuilder &outputBuilder, std::string_view line){
+        Instruction result = parser.parseLineIntoInstruction(line);
+        if(result.cleanInstruction.length() == 0){
+            if(result.label.length() != 0){
+                defineLabel(result.label, result.address);
+            }
+            return;
+        }
+        if(labelAddressMap.labelExists(result.label)){
+            throw ("ERR: Duplicate labels detected.");
+        }
+        if(result.label.length() != 0){
+            defineLabel(result.label, result.address);
+        }
+        int opCode = fiscisa::lookupMnemonic(result.tokens[0]);
+        if(opCode == fiscisa::BNZ && result.tokenCount == 2 && !labelAddressMap.labelExists(result.tokens[1])){
+            fixups[std::string(result.tokens[1])].push_back(count);
+            if(!seekable){
+                unresolved.insert(count);
+            }
+            emit(fiscisa::encodeBranch(0));
+            return;
+        }
+        emit(outputBuilder.instructionToDecimal(result));
+    }
+
+    public:
+    /**
+     * Assembles standard input (or any stream) into the object file
+     * 
+     * @param in - source text
+     * @param objectFile - file to write, "-" for standard output
+     */
+    void run(std::istream &in, const std::string &objectFile){
+        static const char header[] = "v2.0 raw\n";
+        if(objectFile != "-"){
+            file.open(objectFile, std::ios::binary | std::ios::trunc);
+            if(!file.good()){
+                throw ("ERR: Cannot open file.");
+            }
+            // A FIFO or /dev/stdout opens fine but cannot be patched
+            std::error_code error;
+            seekable = std::filesystem::is_regular_file(objectFile, error);
+            out = &file;
+        }
+        else{
+            out = &std::cout;
+        }
+        out->write(header, sizeof(header) - 1);
+
+        Parser parser;
+        OutputBuilder outputBuilder(labelAddressMap);
+        parser.readChunks(in, 
+            [this, &parser, &outputBuilder](std::string_view line){ assembleLine(parser, outputBuilder, line); },
+            [this](std::string_view){
+                if(!seekable){
+                    release();
+                    out->flush();
+                }
+            });
+        if(!fixups.empty()){
+            throw ("ERR: Label not found");
+        }
+        if(!seekable){
+            release();
+        }
+        if(!out->flush()){
+            throw ("ERR: Cannot write object file.");
+        }
+    }
+};
+
+// Assembles every source/object pair listed in a manifest in one process
+class BatchAssembler{
+    private:
+    struct Job{
+        std::string source;
+        std::string object;
+        bool listOutput;
+        bool binaryOutput;
+        bool incremental;
+        bool optimize;
+    };
+    std::vector<Job> jobs;
+    int threads = 1;
+
+    public:
+    /**
+     * Parses "--batch <manifest> [-j threads]"
+     */
+    void initFromCmdLine(int argc, char *argv[]){
+        if(argc < 3){
+            throw ("ERR: Missing manifest file.");
+        }
+        for(int i = 3; i < argc; i++){
+            std::string option(argv[i]);
+            if(!option.compare("-j") && i + 1 < argc){
+                threads = std::atoi(argv[++i]);
+                if(threads < 1){
+                    throw ("ERR: Invalid thread count.");
+                }
+            }
+            else{
+                throw ("ERR: Invalid option.");
+            }
+        }
+        readManifest(argv[2]);
+    }
+
+    /**
+     * Reads the manifest, one "<source file> <object file> [-l] [-b] [-c] [-O]" per line
+     * Fields are separated by spaces or tabs, a path in double quotes may contain them (\" and \\ escape)
+     * Blank lines and lines starting with ';' are skipped
+     * 
+     * @param filename - manifest file
+     */
+    void readManifest(std::string filename){
+        std::ifstream manifest(filename);
+        if(!manifest.good()){
+            throw ("ERR: Cannot open manifest file.");
+        }
+        std::string line;
+        while(std::getline(manifest, line)){
+            std::istringstream fields(line);
+            Job job{"", "", false, false, false, false};
+            if(!(fields >> std::ws) || fields.peek() == ';' || !(fields >> std::quoted(job.source))){
+                continue;
+            }
+            if(!(fields >> std::quoted(job.object))){
+                throw ("ERR: Manifest line has no object file.");
+            }
+            std::string option;
+            while(fields >> option){
+                if(option == "-l"){
+                    job.listOutput = true;
+                }
+                else if(option == "-b"){
+                    job.binaryOutput = true;
+                }
+                else if(option == "-c"){
+                    job.incremental = true;
+                }
+                else if(option == "-O"){
+                    job.optimize = true;
+                }
+                else{
+                    throw ("ERR: Invalid option in manifest.");
+                }
+            }
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    /**
+     * Assembles every job, [threads] files at a time
+     * Each worker reuses one Assembler for all the files it picks up
+     * A failing file is reported on standard error and the batch carries on
+     * Listings are printed in manifest order once every file is done
+     * 
+     * @return Number of files that failed
+     */
+    int run(){
+        std::vector<std::string> listings(jobs.size());
+        std::vector<const char*> errors(jobs.size(), nullptr);
+        std::atomic<size_t> next(0);
+
+        auto worker = [&](){
+            Assembler assembler;
+            for(size_t k = next++; k < jobs.size(); k = next++){
+                const Job &job = jobs[k];
+                std::ostringstream listing;
+                try{
+                    assembler.init(job.source, job.object, job.listOutput, job.binaryOutput, job.incremental, 
+                        job.optimize);
+                    assembler.passOne();
+                    assembler.optimize();
+                    assembler.passTwo(listing);
+                }
+                catch(const char* err){
+                    errors[k] = err;
+                }
+                listings[k] = listing.str();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for(int t = 1; t < threads && (size_t)t < jobs.size(); t++){
+            workers.emplace_back(worker);
+        }
+        worker();
+        for(std::thread &w: workers){
+            w.join();
+        }
+
+        int failed = 0;
+        for(size_t k = 0; k < jobs.size(); k++){
+            std::cout << listings[k];
+            if(errors[k]){
+                std::cerr << jobs[k].source << ": " << errors[k] << std::endl;
+                failed++;
+            }
+        }
+        return failed;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,279 @@
+/**
+ * FISC Benchmark
+ *
+ * Measures the assembler and the simulator without the cost of printing a trace.
+ * Large sources are generated from Examples/count255.s and Examples/fibo1.s by repeating
+ * their bodies with renamed labels. Results are printed as JSON on stdout.
+ *
+ * Build: g++ -std=c++17 -O2 -pthread fiscbench.cpp -o fiscbench
+ * Usage: ./fiscbench [examples directory] [--lines n] [--cycles n]
+*/
+
+// Imports
+#include "fiscsim.h"
+#include "fiscas.h"
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+
+// Generates the inputs, runs every benchmark and reports the results
+class Benchmark{
+    private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::string examples = "Examples";
+    size_t lines = 100000;
+    std::uint64_t cycles = 50000000;
+    std::string json;
+
+    /**
+     * @return Seconds elapsed since start
+     */
+    static double since(Clock::time_point start){
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    /**
+     * Appends one "name": value pair to the JSON output
+     * A rate over a time too short for the clock to measure is not finite and is written as null
+     */
+    void field(const std::string &name, double value, bool last = false){
+        char number[64] = "null";
+        if(std::isfinite(value)){
+            snprintf(number, sizeof(number), "%.6g", value);
+        }
+        json += "      \"" + name + "\": " + number + (last ? "\n" : ",\n");
+    }
+
+    /**
+     * Repeats the body of a source until it has at least the given number of lines
+     * Every copy gets its own labels (label_k), so the result assembles without duplicates
+     *
+     * @param text - assembly source
+     * @param count - minimum number of lines
+     * @return The generated source
+     */
+    static std::string replicate(const std::string &text, size_t count){
+        fiscas::Parser parser;
+        std::vector<std::string> labels;
+        size_t position = 0;
+        std::string_view line;
+        while(parser.nextLine(text, position, line)){
+            fiscas::Instruction i = parser.parseLineIntoInstruction(line);
+            if(i.label.length() != 0){
+                labels.push_back(std::string(i.label));
+            }
+        }
+        std::string result;
+        size_t generated = 0;
+        for(size_t copy = 0; generated < count; copy++){
+            std::string suffix = "_" + std::to_string(copy);
+            position = 0;
+            while(parser.nextLine(text, position, line) && generated < count){
+                std::string renamed(line);
+                for(const std::string &label: labels){
+                    size_t at = 0;
+                    while((at = renamed.find(label, at)) != std::string::npos){
+                        size_t end = at + label.size();
+                        bool word = (at == 0 || !isalnum((unsigned char)renamed[at - 1]))
+                            && (end == renamed.size() || !isalnum((unsigned char)renamed[end]));
+                        if(word){
+                            renamed.insert(end, suffix);
+                            end += suffix.size();
+                        }
+                        at = end;
+                    }
+                }
+                result += renamed;
+                result += '\n';
+                generated++;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Times the assembler phases on a generated source
+     *
+     * @param name - example the source is generated from
+     * @param text - generated source
+     */
+    void benchAssembler(const std::string &name, const std::string &text){
+        std::filesystem::path directory = std::filesystem::temp_directory_path();
+        std::string source = (directory / ("fiscbench_" + name + ".s")).string();
+        std::string object = (directory / ("fiscbench_" + name + ".hex")).string();
+        std::ofstream out(source, std::ios::binary);
+        out << text;
+        out.close();
+
+        fiscas::Assembler assembler;
+        assembler.init(source, object, false, false, false);
+        Clock::time_point start = Clock::now();
+        assembler.passOne();
+        double passOne = since(start);
+        start = Clock::now();
+        std::vector<std::string> chunks = assembler.encodeProgram();
+        double passTwo = since(start);
+        start = Clock::now();
+        assembler.writeObject(chunks);
+        double write = since(start);
+        std::filesystem::remove(source);
+        std::filesystem::remove(object);
+
+        json += "    \"" + name + "\": {\n";
+        field("lines", (double)lines);
+        field("pass_one_seconds", passOne);
+        field("pass_two_seconds", passTwo);
+        field("write_seconds", write);
+        field("pass_one_lines_per_sec", lines / passOne);
+        field("pass_two_lines_per_sec", lines / passTwo);
+        field("write_lines_per_sec", lines / write);
+        field("total_lines_per_sec", lines / (passOne + passTwo + write), true);
+        json += "    }";
+    }
+
+    /**
+     * Runs one engine for the cycle budget
+     * A program that ends is started again from the zero state
+     *
+     * @param program - loaded example
+     * @param engine - naive, predecoded or block
+     * @return Cycles per second
+     */
+    double runEngine(const LoadedProgram &program, const std::string &engine){
+        DiscardSink sink;
+        std::uint64_t total = 0;
+        Clock::time_point start = Clock::now();
+        while(total < cycles){
+            Execute executor(sink, 0);
+            try{
+                program.run(executor, engine, false, cycles - total, false);
+            }
+            catch(const char *){
+            }
+            if(executor.getCompletedCycles() == 0){
+                break;
+            }
+            total += executor.getCompletedCycles();
+        }
+        return total / since(start);
+    }
+
+    /**
+     * Runs groups of random initial states on the SIMD batch engine for the cycle budget
+     *
+     * @param program - loaded example
+     * @return Lane cycles per second
+     */
+    double runBatch(const LoadedProgram &program){
+        BatchExecute batch;
+        std::vector<Memory> states = batch.randomStates(LaneGroup::LANES, 1);
+        std::uint64_t total = 0;
+        Clock::time_point start = Clock::now();
+        while(total < cycles){
+            LaneGroup group;
+            for(int l = 0; l < LaneGroup::LANES; l++){
+                group.set(l, states[l]);
+            }
+            batch.run(program.program, group, std::max<std::uint64_t>(1, (cycles - total) / LaneGroup::LANES));
+            std::uint64_t done = 0;
+            for(int l = 0; l < LaneGroup::LANES; l++){
+                done += group.completedCycles[l];
+            }
+            if(done == 0){
+                break;
+            }
+            total += done;
+        }
+        return total / since(start);
+    }
+
+    /**
+     * Times every execution engine on an example program
+     *
+     * @param name - example name
+     * @param text - assembly source of the example
+     */
+    void benchSimulator(const std::string &name, const std::string &text){
+        fiscas::Assembler assembler;
+        InstructionMemory im;
+        for(std::uint8_t byte: assembler.assembleInMemory(text)){
+            im.insert(Instruction(byte));
+        }
+        Decoder decoder;
+        decoder.decode(im);
+        LoadedProgram program(im);
+
+        json += "    \"" + name + "\": {\n";
+        field("cycles", (double)cycles);
+        field("naive_cycles_per_sec", runEngine(program, "naive"));
+        field("predecoded_cycles_per_sec", runEngine(program, "predecoded"));
+        field("block_cycles_per_sec", runEngine(program, "block"));
+        field("simd_lane_cycles_per_sec", runBatch(program), true);
+        json += "    }";
+    }
+
+    public:
+    /**
+     * Reads the command line
+     *
+     * @param argc - argument count
+     * @param argv - arguments
+     */
+    void initFromCmdLine(int argc, char **argv){
+        for(int i = 1; i < argc; i++){
+            if(strcmp(argv[i], "--lines") == 0 && i + 1 < argc){
+                lines = std::stoull(argv[++i]);
+            }
+            else if(strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+                cycles = std::stoull(argv[++i]);
+            }
+            else if(argv[i][0] != '-'){
+                examples = argv[i];
+            }
+            else{
+                throw ("Usage: ./fiscbench [examples directory] [--lines n] [--cycles n]");
+            }
+        }
+        if(lines == 0 || cycles == 0){
+            throw ("ERR: --lines and --cycles must be positive.");
+        }
+    }
+
+    /**
+     * Runs the assembler and simulator benchmarks and prints the JSON report
+     */
+    void run(){
+        const char *names[2] = {"count255", "fibo1"};
+        std::string texts[2];
+        fiscas::Parser parser;
+        for(int e = 0; e < 2; e++){
+            texts[e] = parser.readFile(examples + "/" + names[e] + ".s");
+        }
+        json = "{\n  \"assembler\": {\n";
+        for(int e = 0; e < 2; e++){
+            benchAssembler(names[e], replicate(texts[e], lines));
+            json += e == 0 ? ",\n" : "\n";
+        }
+        json += "  },\n  \"simulator\": {\n";
+        for(int e = 0; e < 2; e++){
+            benchSimulator(names[e], texts[e]);
+            json += e == 0 ? ",\n" : "\n";
+        }
+        json += "  }\n}\n";
+        std::cout << json;
+    }
+};
+
+int main(int argc, char **argv){
+    try{
+        Benchmark benchmark;
+        benchmark.initFromCmdLine(argc, argv);
+        benchmark.run();
+    }
+    catch(const char* msg){
+        std::cerr << msg << std::endl;
+        return 1;
+    }
+    return 0;
+}
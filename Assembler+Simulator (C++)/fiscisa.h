@@ -0,0 +1,164 @@
+/**
+ * FISC instruction set
+ *
+ * Encoding shared by the assembler (fiscas) and the simulator (fiscsim).
+ * Every instruction is one byte:
+ *      add/and/not: opCode (bits 6-7), source1 (bits 4-5), source2 (bits 2-3), destination (bits 0-1)
+ *      bnz:         opCode (bits 6-7), branch address (bits 0-5)
+ * Everything is constexpr so the encoder and the decoder are checked against each other at compile time.
+*/
+
+#ifndef FISCISA_H
+#define FISCISA_H
+
+// Imports
+#include <cstdint>
+#include <string_view>
+
+namespace fiscisa{
+
+const int ADD = 0;
+const int AND = 1;
+const int NOT = 2;
+const int BNZ = 3;
+
+/**
+ * Encodes an add, and or not instruction
+ * not only reads source1, the assembler passes 0 as source2
+ *
+ * @param opCode - ADD, AND or NOT
+ * @param destination - destination register
+ * @param source1 - first source register
+ * @param source2 - second source register
+ * @return The instruction byte
+ */
+constexpr std::uint8_t encode(int opCode, int destination, int source1, int source2){
+    return (std::uint8_t)((opCode & 3) << 6 | (source1 & 3) << 4 | (source2 & 3) << 2 | (destination & 3));
+}
+
+/**
+ * Encodes a bnz instruction
+ *
+ * @param address - branch address (0-63)
+ * @return The instruction byte
+ */
+constexpr std::uint8_t encodeBranch(int address){
+    return (std::uint8_t)(BNZ << 6 | (address & 63));
+}
+
+// Field extractors, the inverse of encode/encodeBranch
+constexpr int opCode(std::uint8_t instruction){ return instruction >> 6; }
+constexpr int source1(std::uint8_t instruction){ return (instruction >> 4) & 3; }
+constexpr int source2(std::uint8_t instruction){ return (instruction >> 2) & 3; }
+constexpr int destination(std::uint8_t instruction){ return instruction & 3; }
+constexpr int branchAddress(std::uint8_t instruction){ return instruction & 63; }
+
+/**
+ * Number of operands written after each mnemonic, indexed by opCode
+ */
+constexpr int operandCount(int opCode){
+    return opCode == BNZ ? 1 : (opCode == NOT ? 2 : 3);
+}
+
+/**
+ * Lower cases an ASCII letter
+ */
+constexpr char lower(char c){
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/**
+ * Mnemonic table indexed by a perfect hash of the first two letters
+ * (lower(c0) + lower(c1)) % 16 puts add at 5, and at 15, not at 13 and bnz at 0
+ */
+struct MnemonicSlot{
+    std::string_view name;
+    int opCode;
+};
+
+constexpr int mnemonicHash(char first, char second){
+    return (lower(first) + lower(second)) % 16;
+}
+
+constexpr MnemonicSlot MNEMONICS[16] = {
+    {"bnz", BNZ}, {"", -1}, {"", -1}, {"", -1},
+    {"", -1}, {"add", ADD}, {"", -1}, {"", -1},
+    {"", -1}, {"", -1}, {"", -1}, {"", -1},
+    {"", -1}, {"not", NOT}, {"", -1}, {"and", AND},
+};
+
+/**
+ * Looks up a mnemonic, ignoring case
+ *
+ * @param name - mnemonic token
+ * @return The opCode of the mnemonic or -1
+ */
+constexpr int lookupMnemonic(std::string_view name){
+    if(name.size() != 3){
+        return -1;
+    }
+    const MnemonicSlot &slot = MNEMONICS[mnemonicHash(name[0], name[1])];
+    if(slot.opCode < 0){
+        return -1;
+    }
+    for(int i = 0; i < 3; i++){
+        if(lower(name[i]) != slot.name[i]){
+            return -1;
+        }
+    }
+    return slot.opCode;
+}
+
+/**
+ * Looks up a register name (r0-r3), ignoring case
+ *
+ * @param name - register token
+ * @return The register number or -1
+ */
+constexpr int lookupRegister(std::string_view name){
+    if(name.size() != 2 || lower(name[0]) != 'r' || name[1] < '0' || name[1] > '3'){
+        return -1;
+    }
+    return name[1] - '0';
+}
+
+/**
+ * Checks that decoding then re-encoding gives back every one of the 256 instruction bytes
+ */
+constexpr bool roundTripsAllBytes(){
+    for(int b = 0; b < 256; b++){
+        std::uint8_t instruction = (std::uint8_t)b;
+        std::uint8_t encoded = opCode(instruction) == BNZ
+            ? encodeBranch(branchAddress(instruction))
+            : encode(opCode(instruction), destination(instruction), source1(instruction), source2(instruction));
+        if(encoded != instruction){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks that every mnemonic hashes to its own slot
+ */
+constexpr bool mnemonicsResolve(){
+    return lookupMnemonic("add") == ADD && lookupMnemonic("AND") == AND
+        && lookupMnemonic("Not") == NOT && lookupMnemonic("bnz") == BNZ
+        && lookupMnemonic("bad") == -1 && lookupMnemonic("r0") == -1
+        && lookupRegister("r3") == 3 && lookupRegister("R0") == 0 && lookupRegister("r4") == -1;
+}
+
+// Test vectors from Examples/count255.s and countout.hex
+static_assert(encode(NOT, 0, 1, 0) == 0x90, "not r0 r1");
+static_assert(encode(AND, 0, 0, 1) == 0x44, "and r0 r0 r1");
+static_assert(encode(AND, 3, 0, 0) == 0x43, "and r3 r0 r0");
+static_assert(encode(ADD, 1, 1, 1) == 0x15, "add r1 r1 r1");
+static_assert(encodeBranch(5) == 0xC5, "bnz loop");
+static_assert(opCode(0x90) == NOT && destination(0x90) == 0 && source1(0x90) == 1, "decode not r0 r1");
+static_assert(opCode(0xC5) == BNZ && branchAddress(0xC5) == 5, "decode bnz loop");
+static_assert(roundTripsAllBytes(), "encoder and decoder disagree");
+static_assert(mnemonicsResolve(), "mnemonic table is not a perfect hash");
+
+}
+
+#endif
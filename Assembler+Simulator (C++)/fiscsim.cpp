@@ -6,402 +6,85 @@
 */
 
 // Imports
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <cstdint>
-#include <vector>
-#include <cstring>
-#include <iomanip>
-#include <sstream>
-#include <cmath>
-
-/**
- * Instruction split into components
- * address - line number
- * opCode - code for instruction
- * operand[1,2,3] - register values
- */
-struct Instruction{
-    int address;
-    std::uint8_t unsignedInstruction;
-    std::string disassembledInstruction;
-    int opCode;
-    int operand1;
-    int operand2;
-    int operand3;
-
-    // Initializes each value
-    Instruction(std::uint8_t unsignedIns):
-        address(-1), 
-        unsignedInstruction(unsignedIns), 
-        disassembledInstruction(""), 
-        opCode(-1), 
-        operand1(-1), 
-        operand2(-1), 
-        operand3(-1){}
-};
-
-/**
- * Vector of instruction objects
- */
-struct InstructionMemory{
-    std::vector<Instruction> instructions;
-    void insert(Instruction i){
-        instructions.push_back(i);
-    }
-};
-
-// Decodes each instruction into vvalues for the operation and registers
-class Decoder{
-    private:
-    const int ADD = 0;
-    const int AND = 1;
-    const int NOT = 2;
-    const int BNZ = 3;
-    
-    public:
-    /**
-     * Read the input file and create instruction objects for each line, add to instruction memory
-     * 
-     * @param filename - name of input file
-     * @param im - reference to instruction  memory object
-     */
-    void readFile(std::string filename, InstructionMemory &im){
-        std::vector<std::string> hexInstructions;
-        std::string lineFromFile;
-        std::ifstream myfile;
-        myfile.open(filename);
-        std::getline(myfile, lineFromFile);
-        if(lineFromFile != "v2.0 raw"){
-            throw ("ERR: Unable to read file.");
-        }
-        while(std::getline(myfile, lineFromFile)){
-            Instruction i = createInstruction(lineFromFile);
-            im.insert(i);
-        }
-    }
-
-    /**
-     * Convert to hex instruction to unisgned binary
-     * 
-     * @return Unsigned binary instruction
-     */
-    Instruction createInstruction(std::string instruction){
-            int hexInstruction;
-            std::stringstream stream;
-            stream << instruction;
-            stream >> std::hex >> hexInstruction;
-            std::uint8_t unsignedInstruction = (uint8_t)hexInstruction;
-            Instruction i(unsignedInstruction);
-        return i;
-    }
-
-    /**
-     * For each instruction, decode the instruction parts into integers and store into instruction object
-     * Decoded differently depending on instruction structure:
-     *      ADD [destination] [source1] [source2]
-     *      AND [destination] [source1] [source2]
-     *      NOT [destination] [source]
-     *      BNZ [branch address]
-     */
-    void decode(InstructionMemory &im){
-        int address = 0;
-        for(Instruction &i: im.instructions){
-            std::uint8_t instruction = i.unsignedInstruction;
-            i.address = address;
-            address += 1;
-
-            i.opCode = getBits(i.unsignedInstruction, 6, 8);
-            if(i.opCode == ADD || i.opCode == AND || i.opCode == NOT){
-                i.operand1 = getBits(i.unsignedInstruction, 0, 2);
-                i.operand2 = getBits(i.unsignedInstruction, 4, 6);
-            }
-            if(i.opCode == ADD || i.opCode == AND){
-                i.operand3 = getBits(i.unsignedInstruction, 2, 4);
-            }
-            if(i.opCode == BNZ){
-                i.operand1 = getBits(i.unsignedInstruction, 0, 6);
-            }
-        }
-    }
-
-    /**
-     * Get the specified bits in the binary
-     * 
-     * @param num - the binary value of the instruction
-     * @param start - start of the bit range to get
-     * @param end - end of the bit range to bit
-     */
-    std::int8_t getBits(std::int8_t num, int start, int end){
-        // start = inclusive, end = exclusive
-        num = num >> start;
-        int mask = (1 << end - start) - 1;
-        std::int8_t result = num & mask;
-        return result;
-    }
-};
-
-// Reconstructs each instructor with the register and operation integer values
-class Diassembler{
-    public:
-    /**
-     * Convert the instruction back into the string instruction (ex: not r0 r1)
-     * 
-     * Decodes each operation/register into words
-     * Combine the words base on the instruction type
-     * 
-     * @param im - Reference to instruction memory
-     */
-    void disassemble(InstructionMemory &im){
-        for(Instruction &i: im.instructions){
-            std::string strInstruction;
-            std::string operation = decodeOperation(i.opCode);
-            std::string operand1 = decodeRegister(i.operand1);
-            std::string strOperand1 = std::to_string(i.operand1);
-            std::string operand2 = decodeRegister(i.operand2);
-            std::string operand3 = decodeRegister(i.operand3);
-            if(i.opCode == 0 || i.opCode == 1){
-                strInstruction = operation + operand1 + operand2 + operand3;
-            }
-            else if(i.opCode == 2){
-                strInstruction = operation + operand1 + operand2;
-            }
-            else if(i.opCode == 3){
-                strInstruction = operation + strOperand1;
-            }
-            i.disassembledInstruction = strInstruction;
-        }
-    }
-
-    /**
-     * Decodes each operation value to the corresponding instruction name
-     * 
-     * @param opCode - operation code (corresponding to an instruction)
-     * @return Name of the instruction as string
-     */
-    std::string decodeOperation(int opCode){
-        switch(opCode){
-            case 0:
-                return "add ";
-            case 1:
-                return "and ";
-            case 2:
-                return "not ";
-            case 3:
-                return "bnz ";
-            default:
-                return "";
-        }
-    }
-
-    /**
-     * Decodes each register value to the corresponding register name
-     * 
-     * @param regCode - register value
-     * @return Full name of register as string
-     */
-    std::string decodeRegister(int regCode){
-        switch(regCode){
-            case 0:
-                return "r0 ";
-            case 1:
-                return "r1 ";
-            case 2:
-                return "r2 ";
-            case 3:
-                return "r3 ";
-            default:
-                return "";
-        }
-    }
-};
-
-/**
- * Register memory
- * ZFlag - if the previous instruction resulted in 0 (used for bnz (branch if not zero))
- */
-struct Memory{
-    uint8_t registerMemory[4] = {0};
-    int zFlag;
-    int programCounter;
-    Memory():
-        zFlag(0),
-        programCounter(0){};
-};
-
-// Simulates the program using the register memory
-class Execute{
-    private:
-    Memory m;
-    public:
-
-    /**
-     * Simulates the program
-     * 
-     * End the program if cycle stops or end of program
-     * Run each instruction
-     * Return disassembly (the string instruction if [-d] flag is set)
-     * 
-     * @param im - The parameter of the program
-     * @param cycles - The number of cycles to run the program
-     * @param disassembly - Boolean whether or not to disassemble
-     */
-    void runProgram(InstructionMemory im, int cycles, bool disassembly){
-        for(int i = 1; i <= cycles; i++){
-            if(m.programCounter >= im.instructions.size()){
-                throw ("ERR: Cycle stopped, reached end of program.");
-            }
-            Instruction instruction = im.instructions[m.programCounter];
-            runCycle(instruction, disassembly);
-            outputState(i);
-            if(disassembly){
-                outputDisassembly(instruction);
-            }
-        }
-    }
-
-    /**
-     * Outputs the disassmebled instruction
-     * Ex: not r0 r1
-     * 
-     * @param i - instruction to disassemble
-     */
-    void outputDisassembly(Instruction i){
-        std::cout << "Disassembly: ";
-        std::cout << i.disassembledInstruction << std::endl;
-        std::cout << std::endl;
-    }
-
-    /**
-     * Outputs the current state of the program (after each instruction)
-     * Returns the current cycle and values in the registers
-     * @param curCycle - The cycle of the simulation or how many have been instructions executed
-     */
-    void outputState(int curCycle){
-        std::cout << std::dec;
-        std::cout << "Cycle:" << curCycle;
-        std::cout << " State:";
-        std::cout << "PC:" << std::hex << std::uppercase << std::setw(2)
-            << std::setfill('0') << m.programCounter;
-        std::cout << " " << "Z:" << m.zFlag;
-        std::cout << " R0:" << " " << std::hex << std::uppercase << std::setw(2)
-            << std::setfill('0') << (int)m.registerMemory[0];
-        std::cout << " R1:" << " " << std::hex << std::uppercase << std::setw(2)
-            << std::setfill('0') << (int)m.registerMemory[1];
-        std::cout << " R2:" << " " << std::hex << std::uppercase << std::setw(2)
-            << std::setfill('0') << (int)m.registerMemory[2];
-        std::cout << " R3:" << " " << std::hex << std::uppercase << std::setw(2)
-            << std::setfill('0') << (int)m.registerMemory[3] << std::endl;
-    }
-
-    /**
-     * Calls the corresponding operation's functions based on opCode
-     * 
-     * @param i - instruction to execute
-     * @param disassembly - whether or not to disassemble
-     */
-    void runCycle(Instruction i, bool disassembly){
-        if(i.opCode == 0){
-            addOperation(i.operand1, i.operand2, i.operand3);
-        }
-        else if(i.opCode == 1){
-            andOperation(i.operand1, i.operand2, i.operand3);
-        }
-        else if(i.opCode == 2){
-            notOperation(i.operand1, i.operand2);
-        }
-        else if(i.opCode == 3){
-            branch(i.operand1);
-        }
-        if(m.programCounter == 63){
-            m.programCounter = 0;
-        }
-    }
-
-    /**
-     * zFlag = 1 if result of operation is 0
-     * zFlag = 0 if result is nonzero
-     * 
-     * @param regD - the register value of the destination register
-     */
-    void setZFlag(int regD){
-        if(m.registerMemory[regD] == 0){
-            m.zFlag = 1;
-        }
-        else{
-            m.zFlag = 0;
-        }
-    }
-
-    /**
-     * Adds the register values in regN and regM and stores it into regD
-     * Increases the program counter and sets zFlag as necessary
-     * 
-     * @param regD - destination register
-     * @param regN - source 1 register
-     * @param regM - source 2 register
-     */
-    void addOperation(int regD, int regN, int regM){
-        m.registerMemory[regD] = m.registerMemory[regN] + m.registerMemory[regM];
-        setZFlag(regD);
-        m.programCounter += 1;
-    }
-
-    /**
-     * Ands the register values in regN and regM and stores it into regD
-     * Increases the program counter and sets zFlag as necessary
-     * 
-     * @param regD - destination register
-     * @param regN - source 1 register
-     * @param regM - source 2 register
-     */
-    void andOperation(int regD, int regN, int regM){
-        m.registerMemory[regD] = 
-            m.registerMemory[regN] & m.registerMemory[regM];
-        setZFlag(regD);
-        m.programCounter += 1;
-    }
-
-    /**
-     * Performs not operation on regN and stores into regD
-     * Increases the program counter and sets zFlag as necessary
-     * 
-     * @param regD - destination register
-     * @param regN - source 1 register
-     */
-    void notOperation(int regD, int regN){
-        m.registerMemory[regD] = ~m.registerMemory[regN];
-        setZFlag(regD);
-        m.programCounter += 1;
-    }
-
-    /**
-     * Branches/jumps to the specified address if the zFlag is set (zFlag == 1)
-     * 
-     * @param address - address to jump to
-     */
-    void branch(int address){
-        if(!m.zFlag){
-            m.programCounter = address;
-        }else{
-            m.programCounter +=1;
-        }
-    }
-};
+#include "fiscsim.h"
+#include "fiscas.h"
 
 // Runs the entire process (decoding, simulating, disassmebling, etc)
 class Simulator{
     private:
     std::string filename;
-    int cycles = 20;
+    std::string asmFile;
+    std::uint64_t cycles = 20;
+    bool cyclesGiven = false;
     bool disassembly = false;
+    std::uint64_t traceEvery = 1;
+    std::string engine = "naive";
+    bool fastForward = false;
+    std::string traceFile;
+    std::string decodeTraceFile;
+    std::string batchFile;
+    std::uint64_t batchRandom = 0;
+    std::uint64_t seed = 1;
+    std::string sweepFile;
+    size_t threads = 0;
+    std::uint64_t checkpointEvery = 0;
+    std::string checkpointFile;
+    std::uint64_t fromCycle = 0;
+    bool debug = false;
+    bool profile = false;
+    std::uint64_t breakpoints = 0;
+    bool untilHalt = false;
+    std::uint64_t progressEvery = 0;
+    std::string asyncTrace;
+    std::string cosimA;
+    std::string cosimB;
+    bool explore = false;
+    std::uint64_t exploreCount = (std::uint64_t)1 << 32;
+    std::uint64_t memoStates = (std::uint64_t)1 << 22;
+    std::string serveSocket;
+    std::uint64_t cachedPrograms = 256;
     InstructionMemory im;
 
     public:
     void printUsageInfo(){
-        std::cout << "USAGE:\tfiscsim  <object file> [cycles] [-d]";
-        std::cout << "\n\t-d : print disassembly listing with each cycle\n\t";
+        std::cout << "USAGE:\tfiscsim  <object file> [cycles] [options]";
+        std::cout << "\n\t-d : print disassembly listing with each cycle";
+        std::cout << "\n\t-q : quiet, only print the final state";
+        std::cout << "\n\t--trace-every : only print the state of every n-th cycle and the final state";
+        std::cout << "\n\t--engine : naive (default), predecoded or block";
+        std::cout << "\n\t--fast-forward : skip ahead once the state repeats, implies -q";
+        std::cout << "\n\t--trace-bin <file> : write the trace to a binary trace file instead of the screen";
+        std::cout << "\n\t--async-trace <block|drop> : write the trace on a second thread, when it falls behind";
+        std::cout << "\n\t\tthe simulation waits (block) or drops states and reports how many (drop)";
+        std::cout << "\n\t--checkpoint-every <k> : record the state every k cycles (needs --checkpoint-file)";
+        std::cout << "\n\t--checkpoint-file <file> : checkpoints to load and extend, written when the run ends";
+        std::cout << "\n\t\tan existing file keeps its own interval, --checkpoint-every must match it if given";
+        std::cout << "\n\t--from-cycle <n> : replay quietly from the nearest checkpoint and trace from cycle n on";
+        std::cout << "\n\t--profile : count executions per address and opCode, print the hotspots at the end";
+        std::cout << "\n\t--break <pc> : stop once the program counter reaches the address (repeatable)";
+        std::cout << "\n\t--until-halt : stop once the program halts (bnz to itself with Z clear),";
+        std::cout << "\n\t\tcycles become a limit and are unlimited if not given";
+        std::cout << "\n\t--progress <seconds> : print the cycles completed so far to standard error every few seconds";
+        std::cout << "\n\t--debug : read commands from standard input: s [n], r [n] (step back), g <cycle>, p, q";
+        std::cout << "\n\t--cosim <engineA,engineB> : run two engines side by side and report the first cycle they disagree on";
+        std::cout << "\n\t\tengines: naive, predecoded, block, simd, fast-forward (compares the final state only)";
+        std::cout << "\n\t--explore [--explore-count <n>] [--memo <states>] [--threads <n>] : run every initial";
+        std::cout << "\n\t\tR0-R3 (or the first n) with cycles as the limit (default 1000000) and summarise";
+        std::cout << "\n\t\thow they end: end of program, loop or limit";
+        std::cout << "\n\t--batch <file> : run every initial state in the file (R0 R1 R2 R3 in hex per line)";
+        std::cout << "\n\t--batch-random <n> [--seed <s>] : run n random initial states";
+        std::cout << "\n\t\tbatch modes print the final state of every run";
+        std::cout << "\n       fiscsim --asm <source file> [cycles] [options]";
+        std::cout << "\n\tassembles the source in memory and runs it, -d shows labels of bnz targets";
+        std::cout << "\n       fiscsim --sweep <job file> [cycles] [options] [--threads <n>]";
+        std::cout << "\n\truns the jobs (<object file> [cycles] [R0 R1 R2 R3] per line) on all cores";
+        std::cout << "\n\tand prints the final state of each job in order";
+        std::cout << "\n       fiscsim --serve <socket> [--threads <n>] [--cache <programs>]";
+        std::cout << "\n\tanswers run requests on a Unix socket, keeping the last decoded programs (default 256)";
+        std::cout << "\n\trequests: run <object file|hex:bytes> [cycles] [R0 R1 R2 R3] [-t] [-d] [--engine <name>]";
+        std::cout << "\n\t[--fast-forward], stats, shutdown; every reply ends with END";
+        std::cout << "\n       fiscsim --decode-trace <trace file>";
+        std::cout << "\n\tprints a binary trace file as the text trace\n\t";
         std::cout << "if cycles are unspecified the CPU will run for 20 cycles";
     }
 
@@ -413,25 +96,206 @@ class Simulator{
             printUsageInfo();
             throw("");
         }
-        else if(argc > 4){
-            throw ("ERR: Too many arguments");
+        else if(strcmp(argv[1], "--decode-trace") == 0){
+            if(argc != 3){
+                throw ("ERR: --decode-trace needs exactly one trace file");
+            }
+            decodeTraceFile = argv[2];
+            return;
+        }
+        int firstOption = 2;
+        if(strcmp(argv[1], "--sweep") == 0){
+            if(argc < 3){
+                throw ("ERR: Missing sweep file name");
+            }
+            sweepFile = argv[2];
+            firstOption = 3;
+        }
+        else if(strcmp(argv[1], "--serve") == 0){
+            if(argc < 3){
+                throw ("ERR: Missing socket path");
+            }
+            serveSocket = argv[2];
+            firstOption = 3;
+        }
+        else if(strcmp(argv[1], "--asm") == 0){
+            if(argc < 3){
+                throw ("ERR: Missing source file name");
+            }
+            asmFile = argv[2];
+            firstOption = 3;
         }
         else if(argc >= 2){
             filename = argv[1];
         }
-        for(int i = 2; i < argc; i++){
+        for(int i = firstOption; i < argc; i++){
             if(strcmp(argv[i], "-d") == 0){
                 disassembly = true;
             }
+            else if(strcmp(argv[i], "-q") == 0){
+                traceEvery = 0;
+            }
+            else if(strcmp(argv[i], "--trace-every") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1]) || toCycles(argv[i + 1]) == 0){
+                    throw ("ERR: --trace-every needs a positive number");
+                }
+                traceEvery = toCycles(argv[++i]);
+            }
+            else if(strcmp(argv[i], "--fast-forward") == 0){
+                fastForward = true;
+            }
+            else if(strcmp(argv[i], "--batch") == 0){
+                if(i + 1 >= argc){
+                    throw ("ERR: Missing batch file name");
+                }
+                batchFile = argv[++i];
+            }
+            else if(strcmp(argv[i], "--batch-random") == 0 || strcmp(argv[i], "--seed") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1])){
+                    throw ("ERR: Missing number");
+                }
+                std::uint64_t value = toCycles(argv[i + 1]);
+                if(strcmp(argv[i++], "--seed") == 0){
+                    seed = value;
+                }
+                else{
+                    batchRandom = value;
+                }
+            }
+            else if(strcmp(argv[i], "--checkpoint-every") == 0 || strcmp(argv[i], "--from-cycle") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1])){
+                    throw ("ERR: Missing number");
+                }
+                std::uint64_t value = toCycles(argv[i + 1]);
+                if(strcmp(argv[i++], "--from-cycle") == 0){
+                    fromCycle = value;
+                }
+                else if(value == 0){
+                    throw ("ERR: --checkpoint-every needs a positive number");
+                }
+                else{
+                    checkpointEvery = value;
+                }
+            }
+            else if(strcmp(argv[i], "--checkpoint-file") == 0){
+                if(i + 1 >= argc){
+                    throw ("ERR: Missing checkpoint file name");
+                }
+                checkpointFile = argv[++i];
+            }
+            else if(strcmp(argv[i], "--debug") == 0){
+                debug = true;
+            }
+            else if(strcmp(argv[i], "--profile") == 0){
+                profile = true;
+            }
+            else if(strcmp(argv[i], "--break") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1]) || toCycles(argv[i + 1]) > 62){
+                    throw ("ERR: --break needs an address from 0 to 62");
+                }
+                breakpoints |= (std::uint64_t)1 << toCycles(argv[++i]);
+            }
+            else if(strcmp(argv[i], "--until-halt") == 0){
+                untilHalt = true;
+            }
+            else if(strcmp(argv[i], "--progress") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1]) || toCycles(argv[i + 1]) == 0){
+                    throw ("ERR: --progress needs a positive number of seconds");
+                }
+                progressEvery = toCycles(argv[++i]);
+            }
+            else if(strcmp(argv[i], "--explore") == 0){
+                explore = true;
+            }
+            else if(strcmp(argv[i], "--explore-count") == 0 || strcmp(argv[i], "--memo") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1])){
+                    throw ("ERR: Missing number");
+                }
+                std::uint64_t value = toCycles(argv[i + 1]);
+                if(strcmp(argv[i++], "--memo") == 0){
+                    memoStates = value;
+                }
+                else if(value == 0 || value > ((std::uint64_t)1 << 32)){
+                    throw ("ERR: --explore-count needs a number from 1 to 4294967296");
+                }
+                else{
+                    exploreCount = value;
+                }
+            }
+            else if(strcmp(argv[i], "--threads") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1])){
+                    throw ("ERR: Missing number");
+                }
+                threads = (size_t)toCycles(argv[++i]);
+            }
+            else if(strcmp(argv[i], "--cache") == 0){
+                if(i + 1 >= argc || !isNum(argv[i + 1]) || toCycles(argv[i + 1]) == 0){
+                    throw ("ERR: --cache needs a positive number");
+                }
+                cachedPrograms = toCycles(argv[++i]);
+            }
+            else if(strcmp(argv[i], "--trace-bin") == 0){
+                if(i + 1 >= argc){
+                    throw ("ERR: Missing trace file name");
+                }
+                traceFile = argv[++i];
+            }
+            else if(strcmp(argv[i], "--async-trace") == 0){
+                if(i + 1 >= argc || (strcmp(argv[i + 1], "block") != 0 && strcmp(argv[i + 1], "drop") != 0)){
+                    throw ("ERR: --async-trace needs block or drop");
+                }
+                asyncTrace = argv[++i];
+            }
+            else if(strcmp(argv[i], "--cosim") == 0){
+                std::string pair = i + 1 < argc ? argv[++i] : "";
+                size_t comma = pair.find(',');
+                cosimA = pair.substr(0, comma);
+                cosimB = comma == std::string::npos ? "" : pair.substr(comma + 1);
+                for(const std::string &name: {cosimA, cosimB}){
+                    if(name != "naive" && name != "predecoded" && name != "block" && name != "simd" 
+                        && name != "fast-forward"){
+                        throw ("ERR: --cosim needs two engines, e.g. naive,block");
+                    }
+                }
+            }
+            else if(strcmp(argv[i], "--engine") == 0){
+                if(i + 1 >= argc){
+                    throw ("ERR: Missing engine name");
+                }
+                engine = argv[++i];
+                if(engine != "naive" && engine != "predecoded" && engine != "block"){
+                    throw ("ERR: Unknown engine");
+                }
+            }
             else{
                 if(isNum(argv[i])){
-                    cycles = atoi(argv[i]);
+                    if(cyclesGiven){
+                        throw ("ERR: Too many arguments");
+                    }
+                    cycles = toCycles(argv[i]);
+                    cyclesGiven = true;
                 }
                 else{
                     throw ("ERR: Unknown parameter");
                 }
             }
         }
+        if(checkpointEvery != 0 && checkpointFile.empty() && !debug){
+            throw ("ERR: --checkpoint-every needs --checkpoint-file");
+        }
+        if(fastForward && (!checkpointFile.empty() || fromCycle != 0)){
+            throw ("ERR: --fast-forward cannot be combined with checkpoints");
+        }
+        if(profile && (fastForward || debug || !sweepFile.empty() || !batchFile.empty() || batchRandom != 0)){
+            throw ("ERR: --profile only works on a single run without --fast-forward");
+        }
+        if(breakpoints != 0 && (fastForward || debug || !sweepFile.empty() || !batchFile.empty() || batchRandom != 0)){
+            throw ("ERR: --break only works on a single run without --fast-forward");
+        }
+        if((untilHalt || progressEvery != 0) && (fastForward || debug || !sweepFile.empty() || !batchFile.empty() 
+            || batchRandom != 0 || explore || !cosimA.empty() || !serveSocket.empty())){
+            throw ("ERR: --until-halt and --progress only work on a single run without --fast-forward");
+        }
     }
 
     /**
@@ -449,13 +313,51 @@ class Simulator{
         return isNum;
     }
 
+    /**
+     * Converts a cycle count to a 64-bit number
+     * @param num - the digits to convert
+     * @return The number, or throws if it does not fit in 64 bits
+     */
+    std::uint64_t toCycles(const char *num){
+        errno = 0;
+        std::uint64_t value = strtoull(num, nullptr, 10);
+        if(errno == ERANGE){
+            throw ("ERR: Cycle count too large");
+        }
+        return value;
+    }
+
     /**
      * Runs the decoder
+     * In --decode-trace mode the trace file is decoded instead
+     * In --asm mode the source is assembled straight into instruction memory, labels become its symbols
      */
     void decode(){
+        if(!sweepFile.empty() || !serveSocket.empty()){
+            return;
+        }
+        if(!decodeTraceFile.empty()){
+            TraceWriter writer(std::cout);
+            TraceDecoder traceDecoder;
+            traceDecoder.decode(decodeTraceFile, writer);
+            return;
+        }
         Decoder decoder;
         Diassembler disassmebler;
-        decoder.readFile(filename, im);
+        if(!asmFile.empty()){
+            fiscas::Parser parser;
+            fiscas::Assembler assembler;
+            std::vector<std::uint8_t> bytes = assembler.assembleInMemory(parser.readFile(asmFile));
+            for(std::uint8_t byte: bytes){
+                im.insert(Instruction(byte));
+            }
+            for(const auto &label: assembler.getLabels().labelAddressMap){
+                im.symbols.push_back(label);
+            }
+        }
+        else{
+            decoder.readFile(filename, im);
+        }
         decoder.decode(im);
         if(disassembly){
             disassmebler.disassemble(im);
@@ -466,8 +368,149 @@ class Simulator{
      * Executes the program
      */
     void execute(){
-        Execute executor;
-        executor.runProgram(im, cycles, disassembly);
+        if(!decodeTraceFile.empty()){
+            return;
+        }
+        if(!serveSocket.empty()){
+#ifdef FISCSIM_SERVE
+            SimulationServer server(threads, (size_t)cachedPrograms);
+            server.serve(serveSocket);
+            return;
+#else
+            throw ("ERR: --serve needs Unix sockets");
+#endif
+        }
+        if(!sweepFile.empty()){
+            SweepRunner sweep;
+            sweep.run(sweepFile, cycles, engine, fastForward, threads, std::cout);
+            return;
+        }
+        if(!batchFile.empty() || batchRandom != 0){
+            BatchExecute batch;
+            PredecodedProgram program(im);
+            std::vector<Memory> states = batchFile.empty() ? 
+                batch.randomStates(batchRandom, seed) : batch.readStates(batchFile);
+            TraceWriter writer(std::cout);
+            batch.runAll(program, states, cycles, writer);
+            return;
+        }
+        if(explore){
+            PredecodedProgram program(im);
+            TraceWriter writer(std::cout);
+            StateExplorer explorer(program, cyclesGiven ? cycles : 1000000, (size_t)memoStates);
+            explorer.run(exploreCount, threads, writer);
+            return;
+        }
+        if(!cosimA.empty()){
+            LoadedProgram loaded(im);
+            TraceWriter writer(std::cout);
+            CoSimulator cosim;
+            cosim.run(loaded, cosimA, cosimB, cycles, writer);
+            return;
+        }
+        if(debug){
+            LoadedProgram loaded(im);
+            CheckpointStore checkpoints(im, checkpointEvery != 0 ? checkpointEvery : 1024);
+            if(!checkpointFile.empty()){
+                checkpoints.load(checkpointFile, checkpointEvery);
+            }
+            TraceWriter writer(std::cout);
+            Debugger debugger(loaded.program, checkpoints, writer, disassembly);
+            debugger.run(std::cin);
+            if(!checkpointFile.empty()){
+                checkpoints.save(checkpointFile);
+            }
+            return;
+        }
+        std::unique_ptr<TraceSink> output;
+        if(traceFile.empty()){
+            output.reset(new TraceWriter(std::cout));
+        }
+        else{
+            output.reset(new BinaryTraceWriter(traceFile, im, Memory(), disassembly));
+        }
+        std::unique_ptr<AsyncTraceSink> async;
+        if(!asyncTrace.empty()){
+            async.reset(new AsyncTraceSink(*output, asyncTrace == "drop"));
+        }
+        TraceSink &sink = async ? *async : *output;
+        // The program must outlive the run, the final trace line refers to its disassembly
+        LoadedProgram loaded(im);
+        Execute executor(sink, fastForward ? 0 : traceEvery);
+        ExecutionProfile counters;
+        if(profile){
+            executor.setProfile(&counters);
+        }
+        executor.setBreakpoints(breakpoints);
+        CheckpointStore checkpoints(im, checkpointEvery != 0 ? checkpointEvery : 1024);
+        bool saveCheckpoints = !checkpointFile.empty();
+        // Until halt without a cycle count runs for as long as it takes
+        std::uint64_t budget = untilHalt && !cyclesGiven ? UINT64_MAX : cycles;
+        std::uint64_t startCycle = std::min(fromCycle, budget);
+        if(saveCheckpoints){
+            Memory state;
+            std::uint64_t at;
+            // One cycle early so the trace knows the last executed instruction
+            if(checkpoints.load(checkpointFile, checkpointEvery) && startCycle != 0 
+                && checkpoints.nearest(startCycle - 1, state, at)){
+                executor.resumeAt(state, at);
+            }
+            executor.setCheckpoints(&checkpoints);
+        }
+        bool halted = false;
+        try{
+            executor.skipTo(loaded.program, startCycle, disassembly);
+            if(untilHalt || progressEvery != 0){
+                std::atomic<std::uint64_t> progress(executor.getCompletedCycles());
+                std::unique_ptr<ProgressReporter> reporter;
+                if(progressEvery != 0){
+                    reporter.reset(new ProgressReporter(progress, progressEvery, std::cerr));
+                }
+                halted = loaded.runSliced(executor, engine, budget, disassembly, untilHalt, progress);
+            }
+            else{
+                loaded.run(executor, engine, fastForward, cycles, disassembly);
+            }
+        }
+        catch(const char*){
+            finishRun(executor, checkpoints, counters, async.get(), false);
+            throw;
+        }
+        finishRun(executor, checkpoints, counters, async.get(), halted);
+    }
+
+    /**
+     * Ends a run: writes the final state, the breakpoint or halt reached, the checkpoints and the profile report
+     * 
+     * @param executor - the finished run
+     * @param checkpoints - checkpoints recorded by the run
+     * @param counters - profile of the run
+     * @param async - asynchronous trace sink of the run, nullptr if the trace was written directly
+     * @param halted - whether the run stopped because the program halted
+     */
+    void finishRun(Execute &executor, CheckpointStore &checkpoints, const ExecutionProfile &counters,
+        const AsyncTraceSink *async, bool halted){
+        executor.finish();
+        if(async && async->getDropped() != 0){
+            std::cerr << "Trace: " << async->getDropped() << " states dropped" << std::endl;
+        }
+        if(executor.stoppedAtBreakpoint()){
+            char line[32];
+            snprintf(line, sizeof(line), "Breakpoint at PC:%02X\n", executor.getState().programCounter);
+            std::cout << line;
+        }
+        if(halted){
+            char line[64];
+            snprintf(line, sizeof(line), "Halted at PC:%02X after %llu cycles\n", executor.getState().programCounter,
+                (unsigned long long)executor.getCompletedCycles());
+            std::cout << line;
+        }
+        if(!checkpointFile.empty()){
+            checkpoints.save(checkpointFile);
+        }
+        if(profile){
+            counters.report(im, std::cout);
+        }
     }
 };
 
@@ -0,0 +1,4042 @@
+/** 
+ * FISC Simulator library
+ * 
+ * Decoder, disassembler, execution engines and trace writers of the FISC simulator.
+ * Header only (with fiscisa.h): include it to embed the simulator, FiscMachine is the entry point for that.
+ * fiscsim.cpp builds the command line simulator on top of it.
+*/
+
+#ifndef FISCSIM_H
+#define FISCSIM_H
+
+// Imports
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <array>
+#include <utility>
+#include <cerrno>
+#include <cstdlib>
+#include <random>
+#include <map>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <iterator>
+#include <chrono>
+
+// The simulation server (--serve) needs Unix sockets
+#if defined(__unix__) || defined(__APPLE__)
+#define FISCSIM_SERVE
+#include <list>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "fiscisa.h"
+
+/**
+ * Instruction split into components
+ * address - line number
+ * opCode - code for instruction
+ * operand[1,2,3] - register values
+ */
+struct Instruction{
+    int address;
+    std::uint8_t unsignedInstruction;
+    std::string_view disassembledInstruction;
+    int opCode;
+    int operand1;
+    int operand2;
+    int operand3;
+
+    // Initializes each value
+    Instruction(std::uint8_t unsignedIns):
+        address(-1), 
+        unsignedInstruction(unsignedIns), 
+        disassembledInstruction(), 
+        opCode(-1), 
+        operand1(-1), 
+        operand2(-1), 
+        operand3(-1){}
+};
+
+/**
+ * Vector of instruction objects
+ */
+struct InstructionMemory{
+    std::vector<Instruction> instructions;
+    std::vector<std::pair<std::string, int>> symbols;
+    // Disassembly of bnz instructions that name a label, shared by copies of this memory
+    std::shared_ptr<std::deque<std::string>> labelledText;
+    void insert(Instruction i){
+        instructions.push_back(std::move(i));
+    }
+};
+
+/**
+ * Instruction packed into one byte per field for the predecoded execution core
+ * Operands that the instruction does not use are stored as 0
+ */
+struct PackedInstruction{
+    std::uint8_t opCode;
+    std::uint8_t operand1;
+    std::uint8_t operand2;
+    std::uint8_t operand3;
+};
+
+// Decodes each instruction into vvalues for the operation and registers
+class Decoder{
+    public:
+    /**
+     * Read the input file and create instruction objects for each line, add to instruction memory
+     * The whole file is read with a single read and then scanned in memory
+     * Binary object files (fiscas -b) are recognised by their header
+     * 
+     * @param filename - name of input file
+     * @param im - reference to instruction  memory object
+     */
+    void readFile(std::string filename, InstructionMemory &im){
+        std::ifstream myfile(filename, std::ios::binary | std::ios::ate);
+        if(!myfile.good()){
+            throw ("ERR: Unable to read file.");
+        }
+        std::vector<char> contents((size_t)myfile.tellg());
+        myfile.seekg(0);
+        if(!myfile.read(contents.data(), contents.size())){
+            throw ("ERR: Unable to read file.");
+        }
+        readBuffer(contents.data(), contents.size(), im);
+    }
+
+    /**
+     * Same as readFile, for a "v2.0 raw" image that is already in memory
+     * 
+     * Checks the header once, then scans every line with a hex digit lookup table
+     * into a byte array reserved for the whole image
+     * Like before, each line is one instruction: leading blanks are skipped,
+     * the hex digits that follow are the value (truncated to 8 bits) and a line without digits is 0
+     * 
+     * @param buffer - contents of an object file
+     * @param length - number of characters in the buffer
+     * @param im - reference to instruction memory object
+     */
+    void readBuffer(const char *buffer, size_t length, InstructionMemory &im){
+        if(length >= 4 && memcmp(buffer, "FOBJ", 4) == 0){
+            readObject(buffer, length, im);
+            return;
+        }
+        static const char header[] = "v2.0 raw";
+        const size_t headerLength = sizeof(header) - 1;
+        if(length < headerLength || memcmp(buffer, header, headerLength) != 0){
+            throw ("ERR: Unable to read file.");
+        }
+        size_t position = headerLength;
+        if(position < length && buffer[position] == '\r'){
+            position++;
+        }
+        if(position < length && buffer[position] != '\n'){
+            throw ("ERR: Unable to read file.");
+        }
+        position++;
+
+        const HexTable &hex = hexTable();
+        std::vector<std::uint8_t> bytes;
+        bytes.reserve((length - std::min(position, length)) / 3 + 1);
+        while(position < length){
+            while(position < length && (buffer[position] == ' ' || buffer[position] == '\t')){
+                position++;
+            }
+            unsigned value = 0;
+            while(position < length && hex.value[(unsigned char)buffer[position]] >= 0){
+                value = (value << 4) | hex.value[(unsigned char)buffer[position]];
+                position++;
+            }
+            bytes.push_back((std::uint8_t)value);
+            while(position < length && buffer[position] != '\n'){
+                position++;
+            }
+            position++;
+        }
+
+        im.instructions.reserve(im.instructions.size() + bytes.size());
+        for(std::uint8_t byte: bytes){
+            im.instructions.emplace_back(byte);
+        }
+    }
+
+    /**
+     * Reads a binary object file written by fiscas -b
+     * 
+     * Layout (numbers are little endian):
+     *      "FOBJ", version (1 byte), flags (1 byte, bit 0: symbol section follows),
+     *      instruction count (4 bytes), one byte per instruction,
+     *      symbol count (4 bytes), then per symbol: address (4 bytes), name length (2 bytes), name
+     * 
+     * @param buffer - contents of the object file
+     * @param length - number of bytes in the buffer
+     * @param im - reference to instruction memory object
+     */
+    void readObject(const char *buffer, size_t length, InstructionMemory &im){
+        const unsigned char *data = (const unsigned char*)buffer;
+        size_t position = 4;
+        if(length < 10 || data[position] != 1){
+            throw ("ERR: Unable to read file.");
+        }
+        bool symbols = data[position + 1] & 1;
+        position += 2;
+        size_t count = readNumber(data, length, position, 4);
+        if(count > length - position){
+            throw ("ERR: Unable to read file.");
+        }
+        im.instructions.reserve(im.instructions.size() + count);
+        for(size_t i = 0; i < count; i++){
+            im.instructions.emplace_back(data[position + i]);
+        }
+        position += count;
+        if(symbols){
+            size_t symbolCount = readNumber(data, length, position, 4);
+            for(size_t i = 0; i < symbolCount; i++){
+                int address = (int)readNumber(data, length, position, 4);
+                size_t nameLength = readNumber(data, length, position, 2);
+                if(nameLength > length - position){
+                    throw ("ERR: Unable to read file.");
+                }
+                im.symbols.emplace_back(std::string(buffer + position, nameLength), address);
+                position += nameLength;
+            }
+        }
+    }
+
+    /**
+     * Reads a little endian number and moves past it
+     * 
+     * @param data - object file bytes
+     * @param length - number of bytes
+     * @param position - where the number starts, moved past it
+     * @param bytes - size of the number
+     * @return The number
+     */
+    size_t readNumber(const unsigned char *data, size_t length, size_t &position, int bytes){
+        if(length - position < (size_t)bytes){
+            throw ("ERR: Unable to read file.");
+        }
+        size_t value = 0;
+        for(int b = 0; b < bytes; b++){
+            value |= (size_t)data[position + b] << (8 * b);
+        }
+        position += bytes;
+        return value;
+    }
+
+    /**
+     * Lookup table from character to hex digit value, -1 for anything else
+     */
+    struct HexTable{
+        signed char value[256];
+        HexTable(){
+            for(int c = 0; c < 256; c++){
+                value[c] = -1;
+            }
+            for(int d = 0; d < 10; d++){
+                value['0' + d] = (signed char)d;
+            }
+            for(int d = 0; d < 6; d++){
+                value['a' + d] = (signed char)(10 + d);
+                value['A' + d] = (signed char)(10 + d);
+            }
+        }
+    };
+
+    static const HexTable &hexTable(){
+        static const HexTable table;
+        return table;
+    }
+
+    /**
+     * For each instruction, decode the instruction parts into integers and store into instruction object
+     * Decoded differently depending on instruction structure:
+     *      ADD [destination] [source1] [source2]
+     *      AND [destination] [source1] [source2]
+     *      NOT [destination] [source]
+     *      BNZ [branch address]
+     */
+    void decode(InstructionMemory &im){
+        int address = 0;
+        for(Instruction &i: im.instructions){
+            std::uint8_t instruction = i.unsignedInstruction;
+            i.address = address;
+            address += 1;
+
+            i.opCode = fiscisa::opCode(instruction);
+            if(i.opCode == fiscisa::BNZ){
+                i.operand1 = fiscisa::branchAddress(instruction);
+            }
+            else{
+                i.operand1 = fiscisa::destination(instruction);
+                i.operand2 = fiscisa::source1(instruction);
+            }
+            if(i.opCode == fiscisa::ADD || i.opCode == fiscisa::AND){
+                i.operand3 = fiscisa::source2(instruction);
+            }
+        }
+    }
+};
+
+// Reconstructs each instructor with the register and operation integer values
+class Diassembler{
+    public:
+    /**
+     * Disassembly of every one of the 256 encodings, built once
+     */
+    struct DisassemblyTable{
+        char text[256][16];
+        std::string_view view[256];
+
+        DisassemblyTable(){
+            Diassembler disassembler;
+            for(int b = 0; b < 256; b++){
+                std::uint8_t instruction = (std::uint8_t)b;
+                int opCode = fiscisa::opCode(instruction);
+                std::string strInstruction = disassembler.decodeOperation(opCode);
+                if(opCode == fiscisa::BNZ){
+                    strInstruction += std::to_string(fiscisa::branchAddress(instruction));
+                }
+                else{
+                    strInstruction += disassembler.decodeRegister(fiscisa::destination(instruction));
+                    strInstruction += disassembler.decodeRegister(fiscisa::source1(instruction));
+                    if(opCode != fiscisa::NOT){
+                        strInstruction += disassembler.decodeRegister(fiscisa::source2(instruction));
+                    }
+                }
+                memcpy(text[b], strInstruction.data(), strInstruction.size());
+                view[b] = std::string_view(text[b], strInstruction.size());
+            }
+        }
+    };
+
+    /**
+     * Returns the disassembly of an encoding (ex: 0x90 is "not r0 r1 ")
+     * 
+     * @param instruction - instruction byte
+     * @return View into the static table
+     */
+    static std::string_view text(std::uint8_t instruction){
+        static const DisassemblyTable table;
+        return table.view[instruction];
+    }
+
+    /**
+     * Convert the instruction back into the string instruction (ex: not r0 r1)
+     * 
+     * Each instruction points at the static table entry of its encoding
+     * When the program carries symbols, bnz also names its target (ex: bnz 5 <loop>),
+     * those few strings are built once per program and kept in im.labelledText
+     * 
+     * @param im - Reference to instruction memory
+     */
+    void disassemble(InstructionMemory &im){
+        const std::string *labels[64] = {};
+        for(const auto &symbol: im.symbols){
+            if(symbol.second >= 0 && symbol.second < 64 && labels[symbol.second] == nullptr){
+                labels[symbol.second] = &symbol.first;
+            }
+        }
+        for(Instruction &i: im.instructions){
+            i.disassembledInstruction = text(i.unsignedInstruction);
+            if(i.opCode == fiscisa::BNZ && labels[i.operand1] != nullptr){
+                if(!im.labelledText){
+                    im.labelledText = std::make_shared<std::deque<std::string>>();
+                }
+                im.labelledText->push_back(std::string(i.disassembledInstruction) 
+                    + " <" + *labels[i.operand1] + ">");
+                i.disassembledInstruction = im.labelledText->back();
+            }
+        }
+    }
+
+    /**
+     * Decodes each operation value to the corresponding instruction name
+     * 
+     * @param opCode - operation code (corresponding to an instruction)
+     * @return Name of the instruction as string
+     */
+    std::string decodeOperation(int opCode){
+        switch(opCode){
+            case 0:
+                return "add ";
+            case 1:
+                return "and ";
+            case 2:
+                return "not ";
+            case 3:
+                return "bnz ";
+            default:
+                return "";
+        }
+    }
+
+    /**
+     * Decodes each register value to the corresponding register name
+     * 
+     * @param regCode - register value
+     * @return Full name of register as string
+     */
+    std::string decodeRegister(int regCode){
+        switch(regCode){
+            case 0:
+                return "r0 ";
+            case 1:
+                return "r1 ";
+            case 2:
+                return "r2 ";
+            case 3:
+                return "r3 ";
+            default:
+                return "";
+        }
+    }
+};
+
+/**
+ * Register memory
+ * ZFlag - if the previous instruction resulted in 0 (used for bnz (branch if not zero))
+ */
+struct Memory{
+    uint8_t registerMemory[4] = {0};
+    int zFlag;
+    int programCounter;
+    Memory():
+        zFlag(0),
+        programCounter(0){};
+
+    /**
+     * Packs the whole state into one integer, used to compare and hash states
+     * PC (bits 0-7), Z (bits 8-15), R0-R3 (bits 16-47)
+     * 
+     * @return The packed state
+     */
+    std::uint64_t pack() const{
+        std::uint64_t packed = (std::uint64_t)programCounter | (std::uint64_t)zFlag << 8;
+        for(int r = 0; r < 4; r++){
+            packed |= (std::uint64_t)registerMemory[r] << (16 + 8 * r);
+        }
+        return packed;
+    }
+
+    /**
+     * Rebuilds a state from its packed form
+     * 
+     * @param packed - state packed with pack()
+     * @return The unpacked state
+     */
+    static Memory unpack(std::uint64_t packed){
+        Memory m;
+        m.programCounter = packed & 0xFF;
+        m.zFlag = (packed >> 8) & 0xFF;
+        for(int r = 0; r < 4; r++){
+            m.registerMemory[r] = (packed >> (16 + 8 * r)) & 0xFF;
+        }
+        return m;
+    }
+};
+
+/**
+ * Predecoded program - one packed entry for each of the 64 addresses the program counter can hold
+ * Addresses past the end of the program hold the END opCode so the run loop needs no bounds check
+ * Disassembly views are kept in a separate (cold) array so the table stays small
+ */
+struct PredecodedProgram{
+    static const int SIZE = 64;
+    static const std::uint8_t END = 4;
+    PackedInstruction table[SIZE];
+    std::vector<std::string_view> disassembly;
+    std::shared_ptr<std::deque<std::string>> labelledText;
+
+    /**
+     * Packs the decoded instructions into the table
+     * 
+     * @param im - decoded (and optionally disassembled) instruction memory
+     */
+    PredecodedProgram(const InstructionMemory &im):
+        disassembly(SIZE),
+        labelledText(im.labelledText){
+        for(int address = 0; address < SIZE; address++){
+            table[address] = {END, 0, 0, 0};
+        }
+        for(const Instruction &i: im.instructions){
+            if(i.address >= SIZE){
+                break;
+            }
+            table[i.address].opCode = (std::uint8_t)i.opCode;
+            table[i.address].operand1 = (std::uint8_t)std::max(i.operand1, 0);
+            table[i.address].operand2 = (std::uint8_t)std::max(i.operand2, 0);
+            table[i.address].operand3 = (std::uint8_t)std::max(i.operand3, 0);
+            disassembly[i.address] = i.disassembledInstruction;
+        }
+    }
+
+    /**
+     * Addresses that hold a bnz to themselves, the stop: bnz stop idiom
+     * Once the program counter is at one with Z clear the state never changes again
+     * 
+     * @return Bit k set if address k branches to itself
+     */
+    std::uint64_t haltAddresses() const{
+        std::uint64_t addresses = 0;
+        for(int address = 0; address < SIZE; address++){
+            if(table[address].opCode == fiscisa::BNZ && table[address].operand1 == address){
+                addresses |= (std::uint64_t)1 << address;
+            }
+        }
+        return addresses;
+    }
+
+    /**
+     * @param state - register memory
+     * @return Whether the program has halted in the state: every further cycle leaves it unchanged
+     */
+    bool halted(const Memory &state) const{
+        const PackedInstruction &ins = table[state.programCounter];
+        return ins.opCode == fiscisa::BNZ && ins.operand1 == state.programCounter && !state.zFlag;
+    }
+
+    /**
+     * Runs one cycle on the state
+     * Each cycle is a single table lookup and a switch on the opCode
+     * 
+     * @param state - register memory to update
+     * @return False (and the state is unchanged) if the program counter is past the end of the program
+     */
+    bool step(Memory &state) const{
+        std::uint8_t *r = state.registerMemory;
+        const PackedInstruction &ins = table[state.programCounter];
+        switch(ins.opCode){
+            case 0:
+                r[ins.operand1] = r[ins.operand2] + r[ins.operand3];
+                state.zFlag = r[ins.operand1] == 0;
+                state.programCounter += 1;
+                break;
+            case 1:
+                r[ins.operand1] = r[ins.operand2] & r[ins.operand3];
+                state.zFlag = r[ins.operand1] == 0;
+                state.programCounter += 1;
+                break;
+            case 2:
+                r[ins.operand1] = ~r[ins.operand2];
+                state.zFlag = r[ins.operand1] == 0;
+                state.programCounter += 1;
+                break;
+            case 3:
+                state.programCounter = state.zFlag ? state.programCounter + 1 : ins.operand1;
+                break;
+            default:
+                return false;
+        }
+        if(state.programCounter == 63){
+            state.programCounter = 0;
+        }
+        return true;
+    }
+};
+
+// Destination for the states of traced cycles
+class TraceSink{
+    public:
+    virtual ~TraceSink(){}
+
+    /**
+     * Records the state after a traced cycle
+     * 
+     * @param cycle - the cycle the state belongs to
+     * @param address - address of the instruction executed in the cycle
+     * @param m - register memory after the cycle
+     * @param disassembly - disassembled instruction text, nullptr if disassembly is off
+     */
+    virtual void record(std::uint64_t cycle, int address, const Memory &m, 
+        const std::string_view *disassembly) = 0;
+
+    /**
+     * Writes out everything recorded so far
+     */
+    virtual void flush() = 0;
+};
+
+// Trace sink that drops every state, for runs where only the final state matters
+class DiscardSink: public TraceSink{
+    public:
+    void record(std::uint64_t, int, const Memory &, const std::string_view *) override{}
+    void flush() override{}
+};
+
+/**
+ * Buffered writer for the text trace
+ * 
+ * Each line is formatted directly into a char buffer without iostream manipulators
+ * The buffer is handed to the output stream in one write when it fills up or on flush
+ */
+class TraceWriter: public TraceSink{
+    private:
+    static const size_t CAPACITY = 1 << 16;
+    static const size_t MAX_STATE_LINE = 64;
+    std::ostream &out;
+    std::vector<char> buffer;
+    size_t used = 0;
+
+    /**
+     * Appends text to the buffer, flushing first if it would not fit
+     * 
+     * @param text - characters to append
+     * @param length - number of characters
+     */
+    void put(const char *text, size_t length){
+        if(used + length > CAPACITY){
+            flush();
+        }
+        if(length > CAPACITY){
+            out.write(text, length);
+            return;
+        }
+        memcpy(buffer.data() + used, text, length);
+        used += length;
+    }
+
+    /**
+     * Appends a value as two uppercase hex digits
+     * 
+     * @param value - byte to write
+     */
+    void putHex(unsigned value){
+        static const char digits[] = "0123456789ABCDEF";
+        buffer[used++] = digits[(value >> 4) & 0xF];
+        buffer[used++] = digits[value & 0xF];
+    }
+
+    /**
+     * Appends a value in decimal
+     * 
+     * @param value - number to write
+     */
+    void putDecimal(std::uint64_t value){
+        char digits[20];
+        int count = 0;
+        do{
+            digits[count++] = (char)('0' + value % 10);
+            value /= 10;
+        }while(value != 0);
+        while(count > 0){
+            buffer[used++] = digits[--count];
+        }
+    }
+
+    public:
+    TraceWriter(std::ostream &stream):
+        out(stream),
+        buffer(CAPACITY){}
+
+    ~TraceWriter(){
+        flush();
+    }
+
+    /**
+     * Writes the state line and, if disassembly is on, the disassembly line
+     */
+    void record(std::uint64_t cycle, int /*address*/, const Memory &m, 
+        const std::string_view *disassembly) override{
+        writeState(cycle, m);
+        if(disassembly != nullptr){
+            writeDisassembly(*disassembly);
+        }
+    }
+
+    /**
+     * Writes one state line
+     * Ex: Cycle:7 State:PC:07 Z:0 R0: 01 R1: 01 R2: 00 R3: 00
+     * 
+     * @param cycle - the cycle the state belongs to
+     * @param m - register memory after the cycle
+     */
+    void writeState(std::uint64_t cycle, const Memory &m){
+        if(used + MAX_STATE_LINE > CAPACITY){
+            flush();
+        }
+        put("Cycle:", 6);
+        putDecimal(cycle);
+        put(" State:PC:", 10);
+        putHex(m.programCounter);
+        put(" Z:", 3);
+        putDecimal(m.zFlag);
+        for(int r = 0; r < 4; r++){
+            char label[] = {' ', 'R', (char)('0' + r), ':', ' '};
+            put(label, sizeof(label));
+            putHex(m.registerMemory[r]);
+        }
+        put("\n", 1);
+    }
+
+    /**
+     * Writes text as it is, e.g. a prefix in front of a state line
+     * 
+     * @param text - text to write
+     */
+    void writeText(std::string_view text){
+        put(text.data(), text.size());
+    }
+
+    /**
+     * Writes the disassembly line for a cycle
+     * Ex: Disassembly: not r0 r1
+     * 
+     * @param text - disassembled instruction text
+     */
+    void writeDisassembly(std::string_view text){
+        put("Disassembly: ", 13);
+        put(text.data(), text.size());
+        put("\n\n", 2);
+    }
+
+    /**
+     * Writes the buffered text to the output stream
+     */
+    void flush() override{
+        if(used != 0){
+            out.write(buffer.data(), used);
+            used = 0;
+        }
+        out.flush();
+    }
+};
+
+/**
+ * Binary trace sink - compact fixed-width records instead of text lines
+ * 
+ * File layout:
+ *      header - "FTRC", version, flags (bit 0: disassembly), program length,
+ *               initial PC, initial Z, initial R0-R3, program bytes
+ *      records - 4 bytes each
+ *          byte 0: PC after the cycle (bits 0-5), Z (bit 6), a register changed (bit 7)
+ *          byte 1: address of the executed instruction (bits 0-5), changed register (bits 6-7)
+ *          byte 2: new value of the changed register
+ *          byte 3: cycles since the previous record (bits 0-6), more records follow for this line (bit 7)
+ * 
+ * Registers are only written when they differ from the previous traced state
+ * A line with several changed registers or a gap over 127 cycles takes more than one record
+ */
+class BinaryTraceWriter: public TraceSink{
+    private:
+    static const size_t CAPACITY = 1 << 20;
+    std::ofstream out;
+    std::vector<char> buffer;
+    size_t used = 0;
+    Memory last;
+    std::uint64_t lastCycle = 0;
+
+    public:
+    static constexpr const char *MAGIC = "FTRC";
+    static const std::uint8_t VERSION = 1;
+    static const size_t HEADER_SIZE = 13;
+
+    /**
+     * Opens the trace file and writes the header
+     * 
+     * @param filename - name of the trace file
+     * @param im - the program being simulated
+     * @param initial - register memory before the first cycle
+     * @param disassembly - whether the decoded trace shows disassembly
+     */
+    BinaryTraceWriter(const std::string &filename, const InstructionMemory &im, 
+        const Memory &initial, bool disassembly):
+        out(filename, std::ios::binary),
+        buffer(CAPACITY),
+        last(initial){
+        if(!out.good()){
+            throw ("ERR: Unable to write trace file.");
+        }
+        size_t length = std::min(im.instructions.size(), (size_t)PredecodedProgram::SIZE);
+        char header[HEADER_SIZE] = {MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3], (char)VERSION, 
+            (char)(disassembly ? 1 : 0), (char)length, (char)initial.programCounter, 
+            (char)initial.zFlag, (char)initial.registerMemory[0], (char)initial.registerMemory[1], 
+            (char)initial.registerMemory[2], (char)initial.registerMemory[3]};
+        out.write(header, HEADER_SIZE);
+        for(size_t i = 0; i < length; i++){
+            char byte = (char)im.instructions[i].unsignedInstruction;
+            out.write(&byte, 1);
+        }
+    }
+
+    ~BinaryTraceWriter(){
+        flush();
+    }
+
+    /**
+     * Writes the records for one traced cycle
+     */
+    void record(std::uint64_t cycle, int address, const Memory &m, 
+        const std::string_view * /*disassembly*/) override{
+        int changed[4];
+        int changedCount = 0;
+        for(int r = 0; r < 4; r++){
+            if(m.registerMemory[r] != last.registerMemory[r]){
+                changed[changedCount++] = r;
+            }
+        }
+        std::uint64_t remaining = cycle - lastCycle;
+        int next = 0;
+        bool more = true;
+        while(more){
+            if(used + 4 > CAPACITY){
+                flush();
+            }
+            unsigned delta = remaining > 127 ? 127 : (unsigned)remaining;
+            remaining -= delta;
+            int reg = next < changedCount ? changed[next++] : -1;
+            more = remaining != 0 || next < changedCount;
+            char *rec = buffer.data() + used;
+            rec[0] = (char)((m.programCounter & 0x3F) | (m.zFlag ? 0x40 : 0) | (reg >= 0 ? 0x80 : 0));
+            rec[1] = (char)((address & 0x3F) | ((reg >= 0 ? reg : 0) << 6));
+            rec[2] = (char)(reg >= 0 ? m.registerMemory[reg] : 0);
+            rec[3] = (char)(delta | (more ? 0x80 : 0));
+            used += 4;
+        }
+        last = m;
+        lastCycle = cycle;
+    }
+
+    /**
+     * Writes the buffered records to the file
+     */
+    void flush() override{
+        if(used != 0){
+            out.write(buffer.data(), used);
+            used = 0;
+        }
+        out.flush();
+    }
+};
+
+/**
+ * Trace sink that hands the states to a writer thread
+ * 
+ * The simulation only copies each state into a ring of fixed-size buffers.
+ * The writer thread formats full buffers into the wrapped sink (text or binary) and writes them,
+ * so slow output costs a second core instead of stalling the simulation.
+ * When every buffer is full the simulation either waits (block) or drops the buffer it filled and counts it (drop).
+ * flush() never drops: it hands over what is left and waits until the writer has written everything.
+ */
+class AsyncTraceSink: public TraceSink{
+    private:
+    static const size_t BUFFERS = 4;
+    static const size_t RECORDS = 4096;
+
+    struct Record{
+        std::uint64_t cycle;
+        std::uint64_t state;
+        int address;
+        const std::string_view *disassembly;
+    };
+
+    TraceSink &target;
+    bool dropWhenFull;
+    std::vector<Record> records;
+    size_t counts[BUFFERS] = {0};
+    // The simulation fills buffer head, the writer works on the filled buffers starting at tail
+    size_t head = 0;
+    size_t tail = 0;
+    size_t filled = 0;
+    size_t used = 0;
+    bool done = false;
+    std::uint64_t dropped = 0;
+    std::mutex lock;
+    std::condition_variable bufferFilled;
+    std::condition_variable bufferWritten;
+    std::thread writer;
+
+    /**
+     * Passes the buffer being filled to the writer thread
+     * 
+     * @param mayDrop - drop the buffer instead of waiting if all buffers are in use
+     */
+    void submit(bool mayDrop){
+        std::unique_lock<std::mutex> guard(lock);
+        if(filled == BUFFERS - 1 && mayDrop){
+            dropped += used;
+            used = 0;
+            return;
+        }
+        bufferWritten.wait(guard, [this]{ return filled < BUFFERS - 1; });
+        counts[head] = used;
+        head = (head + 1) % BUFFERS;
+        filled++;
+        used = 0;
+        bufferFilled.notify_one();
+    }
+
+    /**
+     * Writer thread: formats the filled buffers in order until the sink is closed
+     */
+    void writeBuffers(){
+        std::unique_lock<std::mutex> guard(lock);
+        while(true){
+            bufferFilled.wait(guard, [this]{ return filled != 0 || done; });
+            if(filled == 0){
+                return;
+            }
+            size_t buffer = tail;
+            guard.unlock();
+            const Record *first = records.data() + buffer * RECORDS;
+            for(const Record *r = first; r != first + counts[buffer]; r++){
+                target.record(r->cycle, r->address, Memory::unpack(r->state), r->disassembly);
+            }
+            guard.lock();
+            tail = (tail + 1) % BUFFERS;
+            filled--;
+            bufferWritten.notify_all();
+        }
+    }
+
+    public:
+    /**
+     * @param sink - sink the writer thread formats into, only used by that thread until flush()
+     * @param drop - drop states instead of waiting when the writer falls behind
+     */
+    AsyncTraceSink(TraceSink &sink, bool drop):
+        target(sink),
+        dropWhenFull(drop),
+        records(BUFFERS * RECORDS){
+        writer = std::thread(&AsyncTraceSink::writeBuffers, this);
+    }
+
+    ~AsyncTraceSink(){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            done = true;
+        }
+        bufferFilled.notify_one();
+        writer.join();
+    }
+
+    /**
+     * Copies the state into the current buffer
+     */
+    void record(std::uint64_t cycle, int address, const Memory &m, 
+        const std::string_view *disassembly) override{
+        records[head * RECORDS + used] = {cycle, m.pack(), address, disassembly};
+        if(++used == RECORDS){
+            submit(dropWhenFull);
+        }
+    }
+
+    /**
+     * Waits until every recorded state is written, then flushes the wrapped sink
+     */
+    void flush() override{
+        if(used != 0){
+            submit(false);
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        bufferWritten.wait(guard, [this]{ return filled == 0; });
+        target.flush();
+    }
+
+    /**
+     * @return The number of states dropped because the writer fell behind
+     */
+    std::uint64_t getDropped() const{
+        return dropped;
+    }
+};
+
+// Turns a binary trace file back into the text trace
+class TraceDecoder{
+    public:
+    /**
+     * Reads the trace file in large chunks and writes the text trace for every record
+     * 
+     * @param filename - name of the binary trace file
+     * @param writer - text trace writer to write to
+     */
+    void decode(const std::string &filename, TraceWriter &writer){
+        std::ifstream in(filename, std::ios::binary);
+        unsigned char header[BinaryTraceWriter::HEADER_SIZE];
+        if(!in.read((char*)header, sizeof(header)) || 
+            memcmp(header, BinaryTraceWriter::MAGIC, 4) != 0){
+            throw ("ERR: Unable to read trace file.");
+        }
+        if(header[4] != BinaryTraceWriter::VERSION){
+            throw ("ERR: Unsupported trace file version.");
+        }
+        bool disassembly = header[5] & 1;
+        Memory m;
+        m.programCounter = header[7];
+        m.zFlag = header[8];
+        for(int r = 0; r < 4; r++){
+            m.registerMemory[r] = header[9 + r];
+        }
+
+        InstructionMemory im;
+        std::vector<char> program(header[6]);
+        if(!in.read(program.data(), program.size())){
+            throw ("ERR: Unable to read trace file.");
+        }
+        for(char byte: program){
+            im.insert(Instruction((std::uint8_t)byte));
+        }
+        Decoder decoder;
+        Diassembler disassembler;
+        decoder.decode(im);
+        disassembler.disassemble(im);
+
+        std::uint64_t cycle = 0;
+        std::vector<char> chunk(1 << 20);
+        size_t leftover = 0;
+        while(in){
+            in.read(chunk.data() + leftover, chunk.size() - leftover);
+            size_t available = leftover + in.gcount();
+            size_t offset = 0;
+            for(; offset + 4 <= available; offset += 4){
+                const unsigned char *rec = (const unsigned char*)chunk.data() + offset;
+                m.programCounter = rec[0] & 0x3F;
+                m.zFlag = (rec[0] >> 6) & 1;
+                if(rec[0] & 0x80){
+                    m.registerMemory[rec[1] >> 6] = rec[2];
+                }
+                cycle += rec[3] & 0x7F;
+                if(!(rec[3] & 0x80)){
+                    int address = rec[1] & 0x3F;
+                    const std::string_view *text = nullptr;
+                    if(disassembly && address < (int)im.instructions.size()){
+                        text = &im.instructions[address].disassembledInstruction;
+                    }
+                    writer.record(cycle, address, m, text);
+                }
+            }
+            leftover = available - offset;
+            memmove(chunk.data(), chunk.data() + offset, leftover);
+        }
+        writer.flush();
+    }
+};
+
+// Handler for one ALU instruction with its registers bound at compile time
+typedef void (*AluHandler)(std::uint8_t *r);
+
+/**
+ * Executes the add/and/not instruction with the 8-bit encoding Code
+ * The opCode and registers are template constants, so each handler is one or two byte operations
+ * 
+ * @param r - the registers
+ */
+template<int Code>
+void aluHandler(std::uint8_t *r){
+    const int opCode = Code >> 6;
+    const int regD = Code & 3;
+    const int regN = (Code >> 4) & 3;
+    const int regM = (Code >> 2) & 3;
+    if(opCode == 0){
+        r[regD] = r[regN] + r[regM];
+    }
+    else if(opCode == 1){
+        r[regD] = r[regN] & r[regM];
+    }
+    else{
+        r[regD] = ~r[regN];
+    }
+}
+
+/**
+ * Builds the table of handlers indexed by instruction encoding (add, and and not only)
+ */
+template<std::size_t... Codes>
+std::array<AluHandler, sizeof...(Codes)> makeAluHandlers(std::index_sequence<Codes...>){
+    return {{&aluHandler<Codes>...}};
+}
+
+/**
+ * Straight-line run of instructions that ends in bnz, at the PC wrap or at the end of the program
+ * 
+ * The add/and/not instructions are pre-bound handlers run back to back
+ * The Z flag only has to be set once, from the last of them, because nothing in between reads it
+ */
+struct Block{
+    std::vector<AluHandler> handlers;
+    int length = 0;
+    int lastAddress = 0;
+    bool setsZ = false;
+    int zRegister = 0;
+    bool endsInBranch = false;
+    int branchTarget = 0;
+    int nextAddress = 0;
+};
+
+/**
+ * One block for every address
+ * A block of length 0 starts at the end of the program, or at 63, which the program counter never holds
+ */
+struct BlockProgram{
+    Block blocks[PredecodedProgram::SIZE];
+
+    /**
+     * Splits the predecoded program into blocks
+     * 
+     * @param program - The predecoded program
+     */
+    BlockProgram(const PredecodedProgram &program){
+        static const std::array<AluHandler, 192> handlers = 
+            makeAluHandlers(std::make_index_sequence<192>());
+        for(int start = 0; start < PredecodedProgram::SIZE; start++){
+            Block &b = blocks[start];
+            int address = start;
+            // The PC wraps from 63 to 0, so address 63 is never run
+            while(address < 63 && program.table[address].opCode != PredecodedProgram::END){
+                const PackedInstruction &ins = program.table[address];
+                b.length += 1;
+                b.lastAddress = address;
+                address += 1;
+                if(ins.opCode == 3){
+                    b.endsInBranch = true;
+                    b.branchTarget = ins.operand1 == 63 ? 0 : ins.operand1;
+                    break;
+                }
+                int code = fiscisa::encode(ins.opCode, ins.operand1, ins.operand2, ins.operand3);
+                b.handlers.push_back(handlers[code]);
+                b.setsZ = true;
+                b.zRegister = ins.operand1;
+            }
+            b.nextAddress = address == 63 ? 0 : address;
+        }
+    }
+};
+
+/**
+ * Periodic snapshots of a run: the packed state after every interval-th cycle
+ * states[k] is the state after k * interval cycles, states[0] is the initial state
+ * 
+ * File layout (numbers are little endian):
+ *      "FCKP", version (1 byte), program hash (8 bytes), interval (8 bytes),
+ *      state count (8 bytes), then one packed state (8 bytes) per checkpoint
+ */
+struct CheckpointStore{
+    std::uint64_t programHash;
+    std::uint64_t interval;
+    std::vector<std::uint64_t> states;
+
+    /**
+     * @param program - program the checkpoints belong to
+     * @param every - cycles between two checkpoints
+     */
+    CheckpointStore(const InstructionMemory &program, std::uint64_t every):
+        programHash(hash(program)),
+        interval(every){}
+
+    /**
+     * FNV-1a hash of the program bytes, so checkpoints of another program are refused
+     */
+    static std::uint64_t hash(const InstructionMemory &program){
+        std::uint64_t h = 14695981039346656037ull;
+        for(const Instruction &i: program.instructions){
+            h = (h ^ i.unsignedInstruction) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    /**
+     * Stores the state if the cycle is the next checkpoint
+     * 
+     * @param cycle - completed cycles
+     * @param m - state after that cycle
+     */
+    void record(std::uint64_t cycle, const Memory &m){
+        if(cycle % interval == 0 && cycle / interval == states.size()){
+            states.push_back(m.pack());
+        }
+    }
+
+    /**
+     * Finds the latest checkpoint at or before a cycle
+     * 
+     * @param cycle - the cycle to get close to
+     * @param m - receives the state of the checkpoint
+     * @param at - receives the cycle of the checkpoint
+     * @return False if there are no checkpoints
+     */
+    bool nearest(std::uint64_t cycle, Memory &m, std::uint64_t &at) const{
+        if(states.empty()){
+            return false;
+        }
+        std::uint64_t k = std::min<std::uint64_t>(cycle / interval, states.size() - 1);
+        m = Memory::unpack(states[k]);
+        at = k * interval;
+        return true;
+    }
+
+    /**
+     * Reads checkpoints written by save, replacing the interval with the file's
+     * 
+     * @param file - checkpoint file
+     * @param required - interval the user asked for, refused if the file has another one (0 accepts any)
+     * @return False if the file does not exist
+     */
+    bool load(const std::string &file, std::uint64_t required = 0){
+        std::ifstream input(file, std::ios::binary);
+        if(!input.good()){
+            return false;
+        }
+        unsigned char header[29];
+        if(!input.read((char*)header, sizeof(header)) || memcmp(header, "FCKP\x01", 5) != 0){
+            throw ("ERR: Invalid checkpoint file");
+        }
+        if(readNumber(header + 5) != programHash){
+            throw ("ERR: Checkpoint file belongs to another program");
+        }
+        interval = readNumber(header + 13);
+        std::uint64_t count = readNumber(header + 21);
+        if(interval == 0){
+            throw ("ERR: Invalid checkpoint file");
+        }
+        if(required != 0 && interval != required){
+            throw ("ERR: --checkpoint-every does not match the interval of the checkpoint file");
+        }
+        states.clear();
+        unsigned char state[8];
+        for(std::uint64_t k = 0; k < count; k++){
+            if(!input.read((char*)state, 8)){
+                throw ("ERR: Invalid checkpoint file");
+            }
+            states.push_back(readNumber(state));
+        }
+        return true;
+    }
+
+    /**
+     * Writes the checkpoints to a file
+     * 
+     * @param file - checkpoint file
+     */
+    void save(const std::string &file) const{
+        std::string data("FCKP\x01", 5);
+        appendNumber(data, programHash);
+        appendNumber(data, interval);
+        appendNumber(data, states.size());
+        for(std::uint64_t state: states){
+            appendNumber(data, state);
+        }
+        std::ofstream output(file, std::ios::binary);
+        output.write(data.data(), data.size());
+    }
+
+    static void appendNumber(std::string &data, std::uint64_t value){
+        for(int b = 0; b < 8; b++){
+            data += (char)((value >> (8 * b)) & 0xFF);
+        }
+    }
+
+    static std::uint64_t readNumber(const unsigned char *bytes){
+        std::uint64_t value = 0;
+        for(int b = 0; b < 8; b++){
+            value |= (std::uint64_t)bytes[b] << (8 * b);
+        }
+        return value;
+    }
+};
+
+/**
+ * Execution counters of a profiled run
+ * The counters fit in a few cache lines next to each other, so counting touches no cold memory
+ */
+struct ExecutionProfile{
+    alignas(64) std::uint64_t addressCount[64] = {0};
+    std::uint64_t opCount[4] = {0};
+    std::uint64_t branchesTaken = 0;
+
+    /**
+     * Counts one executed instruction
+     * 
+     * @param address - address of the instruction
+     * @param opCode - opCode of the instruction
+     * @param zFlag - zFlag when the instruction ran, a bnz is taken when it is 0
+     */
+    void count(int address, int opCode, int zFlag){
+        addressCount[address]++;
+        opCount[opCode]++;
+        branchesTaken += opCode == fiscisa::BNZ && !zFlag;
+    }
+
+    /**
+     * Prints the instruction mix and the addresses sorted by execution count
+     * Each address is annotated with its label (if the program has symbols) and its disassembly
+     * 
+     * @param im - the profiled program
+     * @param out - where the report is written
+     */
+    void report(const InstructionMemory &im, std::ostream &out) const{
+        std::uint64_t total = 0;
+        for(std::uint64_t c: opCount){
+            total += c;
+        }
+        auto percent = [total](std::uint64_t c){
+            char text[16];
+            snprintf(text, sizeof(text), "%5.1f%%", total == 0 ? 0.0 : 100.0 * c / total);
+            return std::string(text);
+        };
+        const char *names[4] = {"add", "and", "not", "bnz"};
+        out << "Profile: " << total << " cycles\n";
+        for(int op = 0; op < 4; op++){
+            out << "  " << names[op] << ": " << opCount[op] << " " << percent(opCount[op]) << "\n";
+        }
+        out << "  bnz taken: " << branchesTaken << ", not taken: " << opCount[fiscisa::BNZ] - branchesTaken << "\n";
+        std::vector<int> addresses;
+        for(int address = 0; address < 64; address++){
+            if(addressCount[address] != 0){
+                addresses.push_back(address);
+            }
+        }
+        std::stable_sort(addresses.begin(), addresses.end(), [this](int a, int b){
+            return addressCount[a] > addressCount[b];
+        });
+        out << "Hotspots:\n";
+        for(int address: addresses){
+            std::string label;
+            for(const auto &symbol: im.symbols){
+                if(symbol.second == address){
+                    label = symbol.first + ":";
+                    break;
+                }
+            }
+            char line[64];
+            snprintf(line, sizeof(line), "  PC:%02X %-10s %12llu %s  ", address, label.c_str(), 
+                (unsigned long long)addressCount[address], percent(addressCount[address]).c_str());
+            out << line;
+            if((size_t)address < im.instructions.size()){
+                out << Diassembler::text(im.instructions[address].unsignedInstruction);
+            }
+            out << "\n";
+        }
+    }
+};
+
+// Simulates the program using the register memory
+class Execute{
+    private:
+    Memory m;
+    TraceSink &sink;
+    std::uint64_t traceEvery;
+    bool disassembly = false;
+    std::uint64_t completedCycles = 0;
+    std::uint64_t tracedCycle = 0;
+    int lastAddress = 0;
+    const std::string_view *lastDisassembly = nullptr;
+    CheckpointStore *checkpoints = nullptr;
+    ExecutionProfile *profile = nullptr;
+    std::uint64_t breakpoints = 0;
+    std::uint64_t haltAddresses = 0;
+    // Addresses the BREAKPOINTS loops stop at to look closer: breakpoints and halt addresses
+    std::uint64_t stopAddresses = 0;
+    // Set when the run stopped early, at a breakpoint or because the program halted
+    bool breakpointHit = false;
+    bool haltHit = false;
+
+    /**
+     * Features a run loop is compiled for, one bit each
+     *      TRACE - trace points or checkpoints are checked after every cycle
+     *      DISASSEMBLY - the disassembly of the last instruction is kept for the trace
+     *      PROFILE - every cycle is counted into the profile
+     *      BREAKPOINTS - the run stops when the program counter reaches a breakpoint or the program halts
+     * Every combination is its own instantiation, picked once when a run starts,
+     * so the loop without any feature has no per-cycle checks for them
+     * Fast-forward is a run loop of its own (runFastForward) and uses none of them
+     */
+    static const unsigned TRACE = 1;
+    static const unsigned DISASSEMBLY = 2;
+    static const unsigned PROFILE = 4;
+    static const unsigned BREAKPOINTS = 8;
+    static const unsigned FEATURE_SETS = 16;
+
+    typedef void (Execute::*ProgramLoop)(const InstructionMemory &, std::uint64_t);
+    typedef void (Execute::*SegmentLoop)(const PredecodedProgram &, std::uint64_t);
+
+    /**
+     * @return The features the current settings need
+     */
+    unsigned features() const{
+        return (traceEvery != 0 || checkpoints ? TRACE : 0) | (disassembly ? DISASSEMBLY : 0)
+            | (profile ? PROFILE : 0) | (stopAddresses != 0 ? BREAKPOINTS : 0);
+    }
+
+    /**
+     * Called when the program counter reaches one of the stop addresses
+     * 
+     * @param state - state after the cycle
+     * @return True if the run stops here
+     */
+    bool stopsAt(const Memory &state){
+        if(breakpoints >> state.programCounter & 1){
+            breakpointHit = true;
+        }
+        else if(!state.zFlag){
+            breakpointHit = true;
+            haltHit = true;
+        }
+        return breakpointHit;
+    }
+
+    template<size_t... FEATURES>
+    static std::array<ProgramLoop, FEATURE_SETS> programLoops(std::index_sequence<FEATURES...>){
+        return {{&Execute::runProgramLoop<FEATURES>...}};
+    }
+
+    template<size_t... FEATURES>
+    static std::array<SegmentLoop, FEATURE_SETS> segmentLoops(std::index_sequence<FEATURES...>){
+        return {{&Execute::runSegmentLoop<FEATURES>...}};
+    }
+
+    /**
+     * End of the next segment: the cycle budget, the next traced cycle or the next checkpoint
+     */
+    std::uint64_t nextStop(std::uint64_t cycles) const{
+        std::uint64_t stop = cycles;
+        if(traceEvery != 0){
+            stop = std::min(stop, completedCycles - completedCycles % traceEvery + traceEvery);
+        }
+        if(checkpoints){
+            std::uint64_t every = checkpoints->interval;
+            stop = std::min(stop, completedCycles - completedCycles % every + every);
+        }
+        return stop;
+    }
+
+    /**
+     * Traces and checkpoints the current cycle if it is due
+     */
+    void reachedStop(){
+        if(traceEvery != 0 && completedCycles % traceEvery == 0){
+            trace();
+        }
+        if(checkpoints){
+            checkpoints->record(completedCycles, m);
+        }
+    }
+
+    public:
+    /**
+     * @param traceSink - where the trace is written
+     * @param every - trace every n-th cycle, 0 only traces the final state
+     */
+    Execute(TraceSink &traceSink, std::uint64_t every):
+        sink(traceSink),
+        traceEvery(every){}
+
+    /**
+     * @return The current register memory
+     */
+    Memory getState() const{
+        return m;
+    }
+
+    /**
+     * Replaces the register memory, e.g. to start from a given initial state
+     * 
+     * @param state - new register memory
+     */
+    void setState(const Memory &state){
+        m = state;
+    }
+
+    /**
+     * @return The number of cycles run so far
+     */
+    std::uint64_t getCompletedCycles() const{
+        return completedCycles;
+    }
+
+    /**
+     * Counts every executed instruction into the profile
+     * 
+     * @param counters - profile to update, nullptr stops profiling
+     */
+    void setProfile(ExecutionProfile *counters){
+        profile = counters;
+    }
+
+    /**
+     * Stops the run after the cycle that brings the program counter to one of the addresses
+     * 
+     * @param addresses - bit k set breaks at address k, 0 disables breakpoints
+     */
+    void setBreakpoints(std::uint64_t addresses){
+        breakpoints = addresses;
+        stopAddresses = breakpoints | haltAddresses;
+    }
+
+    /**
+     * Stops the run after the cycle that leaves the program halted at one of the addresses
+     * (a bnz to itself with Z clear, see PredecodedProgram::halted)
+     * 
+     * @param addresses - from PredecodedProgram::haltAddresses, 0 disables the check
+     */
+    void setHalts(std::uint64_t addresses){
+        haltAddresses = addresses;
+        stopAddresses = breakpoints | haltAddresses;
+    }
+
+    /**
+     * @return Whether the last run stopped at a breakpoint
+     */
+    bool stoppedAtBreakpoint() const{
+        return breakpointHit && !haltHit;
+    }
+
+    /**
+     * @return Whether the last run stopped because the program halted
+     */
+    bool stoppedAtHalt() const{
+        return haltHit;
+    }
+
+    /**
+     * A stretch of a run can be run again from a saved state only if nothing
+     * is traced, checkpointed, profiled or stopped at on the way
+     * 
+     * @return Whether the run has no such side effects
+     */
+    bool canRerun() const{
+        return traceEvery == 0 && !checkpoints && !profile && stopAddresses == 0;
+    }
+
+    /**
+     * Records checkpoints of the run into the store, starting with the current state
+     * 
+     * @param store - checkpoint store, nullptr stops recording
+     */
+    void setCheckpoints(CheckpointStore *store){
+        checkpoints = store;
+        if(checkpoints){
+            checkpoints->record(completedCycles, m);
+        }
+    }
+
+    /**
+     * Continues a run from a restored state, e.g. a checkpoint
+     * 
+     * @param state - state after the given cycle
+     * @param cycle - the number of cycles already completed
+     */
+    void resumeAt(const Memory &state, std::uint64_t cycle){
+        m = state;
+        completedCycles = cycle;
+        tracedCycle = cycle;
+    }
+
+    /**
+     * Runs up to a cycle without tracing, recording checkpoints on the way
+     * The cycle it stops at is traced if a full run would trace it
+     * 
+     * @param program - The predecoded program
+     * @param cycle - completed cycles to stop at
+     * @param disassembly - Boolean whether or not to disassemble
+     */
+    void skipTo(const PredecodedProgram &program, std::uint64_t cycle, bool disassembly){
+        this->disassembly = disassembly;
+        while(completedCycles < cycle){
+            std::uint64_t stop = cycle;
+            if(checkpoints){
+                std::uint64_t every = checkpoints->interval;
+                stop = std::min(stop, completedCycles - completedCycles % every + every);
+            }
+            runSegment(program, stop - completedCycles);
+            if(checkpoints){
+                checkpoints->record(completedCycles, m);
+            }
+        }
+        // Replaying is quiet, breakpoints only count from the first traced cycle on
+        breakpointHit = false;
+        haltHit = false;
+        if(traceEvery != 0 && completedCycles % traceEvery == 0 && completedCycles != tracedCycle){
+            trace();
+        }
+    }
+
+    /**
+     * Simulates the program
+     * 
+     * End the program if cycle stops or end of program
+     * Run each instruction
+     * Return disassembly (the string instruction if [-d] flag is set)
+     * 
+     * @param im - The parameter of the program
+     * @param cycles - The number of cycles to run the program
+     * @param disassembly - Boolean whether or not to disassemble
+     */
+    void runProgram(const InstructionMemory &im, std::uint64_t cycles, bool disassembly){
+        this->disassembly = disassembly;
+        breakpointHit = false;
+        haltHit = false;
+        static const std::array<ProgramLoop, FEATURE_SETS> loops = 
+            programLoops(std::make_index_sequence<FEATURE_SETS>());
+        (this->*loops[features()])(im, cycles);
+    }
+
+    /**
+     * Cycle loop of runProgram compiled for a set of features
+     */
+    template<size_t FEATURES>
+    void runProgramLoop(const InstructionMemory &im, std::uint64_t cycles){
+        for(std::uint64_t i = completedCycles + 1; i <= cycles; i++){
+            if((size_t)m.programCounter >= im.instructions.size()){
+                throw ("ERR: Cycle stopped, reached end of program.");
+            }
+            const Instruction &instruction = im.instructions[m.programCounter];
+            lastAddress = m.programCounter;
+            runCycle<FEATURES>(instruction);
+            completedCycles = i;
+            if constexpr((FEATURES & DISASSEMBLY) != 0){
+                lastDisassembly = &instruction.disassembledInstruction;
+            }
+            if constexpr((FEATURES & TRACE) != 0){
+                reachedStop();
+            }
+            if constexpr((FEATURES & BREAKPOINTS) != 0){
+                if(stopAddresses >> m.programCounter & 1 && stopsAt(m)){
+                    break;
+                }
+            }
+        }
+    }
+
+    /**
+     * Simulates the program from the predecoded table
+     * 
+     * Same behaviour as runProgram, but the cycles between two traced cycles
+     * are run as one segment with no output in between
+     * 
+     * @param program - The predecoded program
+     * @param cycles - The number of cycles to run the program
+     * @param disassembly - Boolean whether or not to disassemble
+     */
+    void runPredecoded(const PredecodedProgram &program, std::uint64_t cycles, bool disassembly){
+        this->disassembly = disassembly;
+        breakpointHit = false;
+        haltHit = false;
+        while(completedCycles < cycles && !breakpointHit){
+            runSegment(program, nextStop(cycles) - completedCycles);
+            reachedStop();
+        }
+    }
+
+    /**
+     * Simulates the program one block at a time
+     * 
+     * Same behaviour as runPredecoded, but whole blocks are run as one step
+     * The cycle budget and trace points are only checked between blocks,
+     * a block that does not fit before the next traced cycle is stepped one instruction at a time
+     * 
+     * @param blocks - The program split into blocks
+     * @param program - The predecoded program
+     * @param cycles - The number of cycles to run the program
+     * @param disassembly - Boolean whether or not to disassemble
+     */
+    void runBlocks(const BlockProgram &blocks, const PredecodedProgram &program, std::uint64_t cycles, 
+        bool disassembly){
+        // Blocks hide the instructions they fuse, profiled runs, breakpoints and halts step them one at a time
+        if(profile || stopAddresses != 0){
+            runPredecoded(program, cycles, disassembly);
+            return;
+        }
+        this->disassembly = disassembly;
+        while(completedCycles < cycles){
+            runBlockSegment(blocks, program, nextStop(cycles) - completedCycles);
+            reachedStop();
+        }
+    }
+
+    /**
+     * Runs a number of cycles block by block with no output
+     * 
+     * @param blocks - The program split into blocks
+     * @param program - The predecoded program, used for the cycles left over at the end
+     * @param count - The number of cycles to run
+     */
+    void runBlockSegment(const BlockProgram &blocks, const PredecodedProgram &program, 
+        std::uint64_t count){
+        Memory state = m;
+        std::uint8_t *r = state.registerMemory;
+        std::uint64_t remaining = count;
+        int address = -1;
+        while(remaining > 0){
+            const Block &b = blocks.blocks[state.programCounter];
+            if(b.length == 0 || (std::uint64_t)b.length > remaining){
+                break;
+            }
+            for(AluHandler handler: b.handlers){
+                handler(r);
+            }
+            if(b.setsZ){
+                state.zFlag = r[b.zRegister] == 0;
+            }
+            state.programCounter = (b.endsInBranch && !state.zFlag) ? b.branchTarget : b.nextAddress;
+            remaining -= b.length;
+            address = b.lastAddress;
+        }
+        m = state;
+        completedCycles += count - remaining;
+        if(address >= 0){
+            setLastExecuted(program, address);
+        }
+        if(remaining > 0){
+            runSegment(program, remaining);
+        }
+    }
+
+    /**
+     * Simulates the program by jumping ahead once the state starts repeating
+     * 
+     * The whole machine state is a few bytes, so any run long enough must end up in a cycle of states
+     * Brent's cycle detection finds the length of that cycle in O(1) memory,
+     * after which the cycles left over are reduced modulo the cycle length
+     * Only the final state is traced
+     * 
+     * @param program - The predecoded program
+     * @param cycles - The number of cycles to run the program
+     * @param disassembly - Boolean whether or not to disassemble
+     */
+    void runFastForward(const PredecodedProgram &program, std::uint64_t cycles, bool disassembly){
+        this->disassembly = disassembly;
+        Memory tortoise = m;
+        std::uint64_t power = 1;
+        std::uint64_t period = 0;
+        while(completedCycles < cycles){
+            runSegmentLoop<0>(program, 1);
+            period += 1;
+            if(m.pack() == tortoise.pack()){
+                runSegmentLoop<0>(program, (cycles - completedCycles) % period);
+                completedCycles = cycles;
+                break;
+            }
+            if(period == power){
+                tortoise = m;
+                power *= 2;
+                period = 0;
+            }
+        }
+    }
+
+    /**
+     * Runs a number of cycles from the predecoded table with no output
+     * The registers are worked on in a local copy of the memory and written back at the end
+     * 
+     * @param program - The predecoded program
+     * @param count - The number of cycles to run
+     */
+    void runSegment(const PredecodedProgram &program, std::uint64_t count){
+        static const std::array<SegmentLoop, FEATURE_SETS> loops = 
+            segmentLoops(std::make_index_sequence<FEATURE_SETS>());
+        (this->*loops[features()])(program, count);
+    }
+
+    /**
+     * Cycle loop of runSegment compiled for a set of features
+     * Trace points are only handled between segments, so only PROFILE and BREAKPOINTS change the loop
+     * A breakpoint ends the segment early
+     */
+    template<size_t FEATURES>
+    void runSegmentLoop(const PredecodedProgram &program, std::uint64_t count){
+        Memory state = m;
+        int address = lastAddress;
+        for(std::uint64_t n = 0; n < count; n++){
+            int next = state.programCounter;
+            if(!program.step(state)){
+                m = state;
+                completedCycles += n;
+                setLastExecuted(program, address);
+                throw ("ERR: Cycle stopped, reached end of program.");
+            }
+            if constexpr((FEATURES & PROFILE) != 0){
+                profile->count(next, program.table[next].opCode, state.zFlag);
+            }
+            address = next;
+            if constexpr((FEATURES & BREAKPOINTS) != 0){
+                if(stopAddresses >> state.programCounter & 1 && stopsAt(state)){
+                    count = n + 1;
+                    break;
+                }
+            }
+        }
+        m = state;
+        completedCycles += count;
+        setLastExecuted(program, address);
+    }
+
+    /**
+     * Remembers the last executed instruction for the trace
+     * 
+     * @param program - The predecoded program
+     * @param address - address of the instruction
+     */
+    void setLastExecuted(const PredecodedProgram &program, int address){
+        lastAddress = address;
+        lastDisassembly = &program.disassembly[address];
+    }
+
+    /**
+     * Writes the final state if it has not been traced yet and flushes the trace
+     * Called once the run is over, also when it stopped with an error
+     */
+    void finish(){
+        if(completedCycles != tracedCycle){
+            trace();
+        }
+        sink.flush();
+    }
+
+    /**
+     * Outputs the current state of the program (after each instruction)
+     * and the disassembled instruction if [-d] flag is set
+     */
+    void trace(){
+        sink.record(completedCycles, lastAddress, m, disassembly ? lastDisassembly : nullptr);
+        tracedCycle = completedCycles;
+    }
+
+    /**
+     * Calls the corresponding operation's functions based on opCode
+     * With the PROFILE feature it also counts the instruction into the profile
+     * 
+     * @param i - instruction to execute
+     */
+    template<size_t FEATURES = 0>
+    void runCycle(const Instruction &i){
+        if constexpr((FEATURES & PROFILE) != 0){
+            profile->count(m.programCounter, i.opCode, m.zFlag);
+        }
+        if(i.opCode == 0){
+            addOperation(i.operand1, i.operand2, i.operand3);
+        }
+        else if(i.opCode == 1){
+            andOperation(i.operand1, i.operand2, i.operand3);
+        }
+        else if(i.opCode == 2){
+            notOperation(i.operand1, i.operand2);
+        }
+        else if(i.opCode == 3){
+            branch(i.operand1);
+        }
+        if(m.programCounter == 63){
+            m.programCounter = 0;
+        }
+    }
+
+    /**
+     * zFlag = 1 if result of operation is 0
+     * zFlag = 0 if result is nonzero
+     * 
+     * @param regD - the register value of the destination register
+     */
+    void setZFlag(int regD){
+        if(m.registerMemory[regD] == 0){
+            m.zFlag = 1;
+        }
+        else{
+            m.zFlag = 0;
+        }
+    }
+
+    /**
+     * Adds the register values in regN and regM and stores it into regD
+     * Increases the program counter and sets zFlag as necessary
+     * 
+     * @param regD - destination register
+     * @param regN - source 1 register
+     * @param regM - source 2 register
+     */
+    void addOperation(int regD, int regN, int regM){
+        m.registerMemory[regD] = m.registerMemory[regN] + m.registerMemory[regM];
+        setZFlag(regD);
+        m.programCounter += 1;
+    }
+
+    /**
+     * Ands the register values in regN and regM and stores it into regD
+     * Increases the program counter and sets zFlag as necessary
+     * 
+     * @param regD - destination register
+     * @param regN - source 1 register
+     * @param regM - source 2 register
+     */
+    void andOperation(int regD, int regN, int regM){
+        m.registerMemory[regD] = 
+            m.registerMemory[regN] & m.registerMemory[regM];
+        setZFlag(regD);
+        m.programCounter += 1;
+    }
+
+    /**
+     * Performs not operation on regN and stores into regD
+     * Increases the program counter and sets zFlag as necessary
+     * 
+     * @param regD - destination register
+     * @param regN - source 1 register
+     */
+    void notOperation(int regD, int regN){
+        m.registerMemory[regD] = ~m.registerMemory[regN];
+        setZFlag(regD);
+        m.programCounter += 1;
+    }
+
+    /**
+     * Branches/jumps to the specified address if the zFlag is set (zFlag == 1)
+     * 
+     * @param address - address to jump to
+     */
+    void branch(int address){
+        if(!m.zFlag){
+            m.programCounter = address;
+        }else{
+            m.programCounter +=1;
+        }
+    }
+};
+
+/**
+ * A program decoded once and shared read-only by every run of it
+ */
+struct LoadedProgram{
+    InstructionMemory im;
+    PredecodedProgram program;
+    BlockProgram blocks;
+
+    /**
+     * @param instructions - decoded (and optionally disassembled) instruction memory
+     */
+    LoadedProgram(const InstructionMemory &instructions):
+        im(instructions),
+        program(im),
+        blocks(program){}
+
+    /**
+     * Runs the program on the executor with the selected engine
+     * 
+     * @param executor - holds the state of the run
+     * @param engine - naive, predecoded or block
+     * @param fastForward - skip ahead once the state repeats
+     * @param cycles - The number of cycles to run the program
+     * @param disassembly - Boolean whether or not to disassemble
+     */
+    void run(Execute &executor, const std::string &engine, bool fastForward, 
+        std::uint64_t cycles, bool disassembly) const{
+        if(fastForward){
+            executor.runFastForward(program, cycles, disassembly);
+        }
+        else if(engine == "predecoded"){
+            executor.runPredecoded(program, cycles, disassembly);
+        }
+        else if(engine == "block"){
+            executor.runBlocks(blocks, program, cycles, disassembly);
+        }
+        else{
+            executor.runProgram(im, cycles, disassembly);
+        }
+    }
+
+    // Cycles run between two updates of the progress counter
+    static constexpr std::uint64_t SLICE = (std::uint64_t)1 << 24;
+
+    /**
+     * Runs the program with the selected engine in slices of SLICE cycles
+     * After every slice the completed cycles are stored in the progress counter, the cycle loops stay as they are
+     * 
+     * With untilHalt the run also stops once the program halts (a bnz to its own address with Z clear).
+     * If the run can be rerun (see Execute::canRerun), halts are only looked for between slices so the engine
+     * keeps its speed; the slice the program halted in is then run again from its start with the halt
+     * check on, so the run still stops on the exact cycle. Otherwise the halt check is on from the start.
+     * 
+     * @param executor - holds the state of the run
+     * @param engine - naive, predecoded or block
+     * @param cycles - The number of cycles to run the program
+     * @param disassembly - Boolean whether or not to disassemble
+     * @param untilHalt - stop once the program halts
+     * @param progress - set to the completed cycles after every slice
+     * @return True if the program halted
+     */
+    bool runSliced(Execute &executor, const std::string &engine, std::uint64_t cycles, bool disassembly,
+        bool untilHalt, std::atomic<std::uint64_t> &progress) const{
+        std::uint64_t halts = untilHalt ? program.haltAddresses() : 0;
+        if(halts != 0 && program.halted(executor.getState())){
+            return true;
+        }
+        bool rerun = executor.canRerun();
+        if(!rerun){
+            executor.setHalts(halts);
+        }
+        while(executor.getCompletedCycles() < cycles){
+            Memory start = executor.getState();
+            std::uint64_t startCycle = executor.getCompletedCycles();
+            std::uint64_t stop = startCycle + std::min(SLICE, cycles - startCycle);
+            run(executor, engine, false, stop, disassembly);
+            if(halts != 0 && rerun && program.halted(executor.getState())){
+                executor.resumeAt(start, startCycle);
+                executor.setHalts(halts);
+                run(executor, engine, false, stop, disassembly);
+            }
+            progress.store(executor.getCompletedCycles(), std::memory_order_relaxed);
+            if(executor.stoppedAtHalt()){
+                return true;
+            }
+            if(executor.stoppedAtBreakpoint()){
+                break;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * Prints how far a long run is, every few seconds on a thread of its own
+ * 
+ * The run only stores its completed cycles in an atomic counter (see LoadedProgram::runSliced),
+ * this thread samples it. Ex: Progress: 1073741824 cycles, 912.4M cycles/s
+ */
+class ProgressReporter{
+    private:
+    const std::atomic<std::uint64_t> &counter;
+    std::uint64_t seconds;
+    std::ostream &out;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread reporter;
+
+    /**
+     * Prints a line every interval until stopped
+     */
+    void report(){
+        std::uint64_t last = counter.load(std::memory_order_relaxed);
+        std::unique_lock<std::mutex> guard(lock);
+        while(!wake.wait_for(guard, std::chrono::seconds(seconds), [this]{ return stopping; })){
+            std::uint64_t now = counter.load(std::memory_order_relaxed);
+            char line[96];
+            snprintf(line, sizeof(line), "Progress: %llu cycles, %.1fM cycles/s\n", (unsigned long long)now, 
+                (double)(now - last) / seconds / 1e6);
+            out << line << std::flush;
+            last = now;
+        }
+    }
+
+    public:
+    /**
+     * @param cycles - counter of completed cycles
+     * @param interval - seconds between two lines
+     * @param stream - where the lines go, standard error on the command line
+     */
+    ProgressReporter(const std::atomic<std::uint64_t> &cycles, std::uint64_t interval, std::ostream &stream):
+        counter(cycles),
+        seconds(interval),
+        out(stream),
+        reporter(&ProgressReporter::report, this){}
+
+    ~ProgressReporter(){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        reporter.join();
+    }
+};
+
+/**
+ * Interactive debugger that can step backwards
+ * 
+ * Forward steps record a checkpoint every interval cycles. Going back restores
+ * the checkpoint before the target and replays forward, so no cycle has to be undone.
+ * 
+ * Commands (one per line):
+ *      s [n] - step n cycles forward (default 1)
+ *      r [n] - step n cycles backward (default 1)
+ *      g <cycle> - go to a cycle
+ *      p - print the state
+ *      q - quit
+ * Every command except q prints the state afterwards as a trace line
+ */
+class Debugger{
+    private:
+    const PredecodedProgram &program;
+    CheckpointStore &checkpoints;
+    TraceWriter &writer;
+    bool disassembly;
+    Memory m;
+    std::uint64_t cycle = 0;
+    int lastAddress = -1;
+
+    public:
+    /**
+     * @param predecoded - the program to debug
+     * @param store - checkpoints, may already hold some from an earlier run
+     * @param traceWriter - where states are printed
+     * @param disassemble - print the disassembly of the last executed instruction
+     */
+    Debugger(const PredecodedProgram &predecoded, CheckpointStore &store, TraceWriter &traceWriter, 
+        bool disassemble):
+        program(predecoded),
+        checkpoints(store),
+        writer(traceWriter),
+        disassembly(disassemble){
+        checkpoints.record(0, m);
+    }
+
+    /**
+     * Steps forward without printing
+     * 
+     * @param count - number of cycles
+     * @return False if the program ended before that
+     */
+    bool step(std::uint64_t count){
+        for(std::uint64_t n = 0; n < count; n++){
+            int address = m.programCounter;
+            if(!program.step(m)){
+                return false;
+            }
+            lastAddress = address;
+            cycle++;
+            checkpoints.record(cycle, m);
+        }
+        return true;
+    }
+
+    /**
+     * Moves to a cycle, replaying from the nearest checkpoint when the target lies in the past
+     * or the checkpoint is ahead of the current cycle (e.g. loaded from a checkpoint file)
+     * The checkpoint is taken one cycle early so the last executed instruction is known
+     * Without any checkpoint going back starts over from the zero state
+     * 
+     * @param target - the cycle to go to
+     * @return False if the program ended before that
+     */
+    bool goTo(std::uint64_t target){
+        Memory state;
+        std::uint64_t at = 0;
+        bool found = checkpoints.nearest(target == 0 ? 0 : target - 1, state, at);
+        if(target < cycle || (found && at > cycle)){
+            if(!found){
+                state = Memory();
+                at = 0;
+            }
+            m = state;
+            cycle = at;
+            lastAddress = -1;
+        }
+        return step(target - cycle);
+    }
+
+    /**
+     * Prints the current state like a trace line
+     */
+    void print(){
+        const std::string_view *text = nullptr;
+        if(disassembly && lastAddress >= 0){
+            text = &program.disassembly[lastAddress];
+        }
+        writer.record(cycle, lastAddress < 0 ? 0 : lastAddress, m, text);
+        writer.flush();
+    }
+
+    /**
+     * Reads and runs commands until q or the end of the input
+     * 
+     * @param in - command input
+     */
+    void run(std::istream &in){
+        std::string line;
+        while(std::getline(in, line)){
+            std::istringstream words(line);
+            std::string command;
+            if(!(words >> command)){
+                continue;
+            }
+            std::uint64_t count = 1;
+            bool hasCount = (bool)(words >> count);
+            bool ok = true;
+            if(command == "q"){
+                break;
+            }
+            else if(command == "s"){
+                ok = step(count);
+            }
+            else if(command == "r"){
+                ok = goTo(count > cycle ? 0 : cycle - count);
+            }
+            else if(command == "g" && hasCount){
+                ok = goTo(count);
+            }
+            else if(command != "p"){
+                writer.writeText("ERR: Unknown command\n");
+                writer.flush();
+                continue;
+            }
+            if(!ok){
+                writer.writeText("ERR: Cycle stopped, reached end of program.\n");
+            }
+            print();
+        }
+    }
+};
+
+/**
+ * Thread pool where every worker has its own deque of tasks
+ * 
+ * Tasks are handed out round-robin; a worker takes from the back of its own deque
+ * and, once that is empty, steals from the front of the other workers' deques
+ */
+class WorkStealingPool{
+    private:
+    struct Worker{
+        std::deque<std::function<void()>> tasks;
+        std::mutex lock;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex stateLock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t queued = 0;
+    size_t pending = 0;
+    size_t nextWorker = 0;
+    bool stopping = false;
+
+    /**
+     * Takes a task from the worker's own deque or steals one
+     * 
+     * @param self - index of the worker
+     * @param task - set to the task
+     * @return True if a task was found
+     */
+    bool takeTask(size_t self, std::function<void()> &task){
+        for(size_t i = 0; i < workers.size(); i++){
+            Worker &worker = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> guard(worker.lock);
+            if(worker.tasks.empty()){
+                continue;
+            }
+            if(i == 0){
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            else{
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> state(stateLock);
+            queued -= 1;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Runs tasks until the pool is stopped
+     * 
+     * @param self - index of the worker
+     */
+    void workerLoop(size_t self){
+        while(true){
+            std::function<void()> task;
+            if(takeTask(self, task)){
+                task();
+                std::lock_guard<std::mutex> guard(stateLock);
+                pending -= 1;
+                if(pending == 0){
+                    idle.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(stateLock);
+            wake.wait(guard, [this]{ return stopping || queued > 0; });
+            if(stopping && queued == 0){
+                return;
+            }
+        }
+    }
+
+    public:
+    /**
+     * @param threadCount - number of workers, 0 uses one per hardware thread
+     */
+    WorkStealingPool(size_t threadCount){
+        if(threadCount == 0){
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for(size_t i = 0; i < threadCount; i++){
+            workers.emplace_back(new Worker());
+        }
+        for(size_t i = 0; i < threadCount; i++){
+            threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+        }
+    }
+
+    ~WorkStealingPool(){
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(std::thread &t: threads){
+            t.join();
+        }
+    }
+
+    /**
+     * Adds a task, tasks must not throw
+     * 
+     * @param task - function to run on a worker
+     */
+    void submit(std::function<void()> task){
+        size_t target;
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            target = nextWorker;
+            nextWorker = (nextWorker + 1) % workers.size();
+        }
+        {
+            std::lock_guard<std::mutex> guard(workers[target]->lock);
+            workers[target]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            queued += 1;
+            pending += 1;
+        }
+        wake.notify_one();
+    }
+
+    /**
+     * Blocks until every submitted task has finished
+     */
+    void wait(){
+        std::unique_lock<std::mutex> guard(stateLock);
+        idle.wait(guard, [this]{ return pending == 0; });
+    }
+};
+
+/**
+ * Runs a list of simulation jobs on a work-stealing pool
+ * 
+ * Each program is decoded once and shared by its jobs; each job has its own Execute
+ * and writes its final state to its own buffer, which are joined in job order at the end
+ */
+class SweepRunner{
+    private:
+    struct Job{
+        std::string filename;
+        std::uint64_t cycles;
+        Memory initial;
+        std::string result;
+    };
+
+    public:
+    /**
+     * Reads the job file: one job per line as <object file> [cycles] [R0 R1 R2 R3]
+     * 
+     * @param filename - name of the job file
+     * @param defaultCycles - cycles for jobs that do not give any
+     * @return The jobs in file order
+     */
+    std::vector<Job> readJobs(const std::string &filename, std::uint64_t defaultCycles){
+        std::ifstream myfile(filename);
+        if(!myfile.good()){
+            throw ("ERR: Unable to read sweep file.");
+        }
+        std::vector<Job> jobs;
+        std::string lineFromFile;
+        while(std::getline(myfile, lineFromFile)){
+            std::stringstream stream(lineFromFile);
+            Job job;
+            if(!(stream >> job.filename)){
+                continue;
+            }
+            job.cycles = defaultCycles;
+            std::string cycles;
+            if(stream >> cycles){
+                if(cycles.empty() || cycles.find_first_not_of("0123456789") != std::string::npos){
+                    throw ("ERR: Invalid cycle count in sweep file.");
+                }
+                errno = 0;
+                job.cycles = strtoull(cycles.c_str(), nullptr, 10);
+                if(errno == ERANGE){
+                    throw ("ERR: Invalid cycle count in sweep file.");
+                }
+                for(int r = 0; r < 4; r++){
+                    int value;
+                    if(!(stream >> std::hex >> value) || value < 0 || value > 0xFF){
+                        if(r == 0 && stream.eof()){
+                            break;
+                        }
+                        throw ("ERR: Invalid state in sweep file.");
+                    }
+                    job.initial.registerMemory[r] = (std::uint8_t)value;
+                }
+            }
+            jobs.push_back(job);
+        }
+        return jobs;
+    }
+
+    /**
+     * Runs every job and writes one summary line per job, in job order
+     * Ex: Job:0 countout.hex Cycle:20 State:PC:07 Z:0 R0: 01 R1: 01 R2: 00 R3: 00
+     * 
+     * @param filename - name of the job file
+     * @param defaultCycles - cycles for jobs that do not give any
+     * @param engine - naive, predecoded or block
+     * @param fastForward - skip ahead once the state repeats
+     * @param threadCount - number of workers, 0 uses one per hardware thread
+     * @param out - where the summary is written
+     */
+    void run(const std::string &filename, std::uint64_t defaultCycles, const std::string &engine,
+        bool fastForward, size_t threadCount, std::ostream &out){
+        std::vector<Job> jobs = readJobs(filename, defaultCycles);
+
+        // Decode each program once before any job starts, jobs only read them
+        std::map<std::string, std::unique_ptr<LoadedProgram>> programs;
+        std::map<std::string, std::string> loadErrors;
+        for(const Job &job: jobs){
+            if(programs.count(job.filename) || loadErrors.count(job.filename)){
+                continue;
+            }
+            try{
+                InstructionMemory im;
+                Decoder decoder;
+                decoder.readFile(job.filename, im);
+                decoder.decode(im);
+                programs[job.filename].reset(new LoadedProgram(im));
+            }
+            catch(const char* err){
+                loadErrors[job.filename] = err;
+            }
+        }
+
+        {
+            WorkStealingPool pool(threadCount);
+            for(Job &job: jobs){
+                auto found = programs.find(job.filename);
+                if(found == programs.end()){
+                    job.result = loadErrors[job.filename] + "\n";
+                    continue;
+                }
+                const LoadedProgram *loaded = found->second.get();
+                Job *current = &job;
+                pool.submit([current, loaded, &engine, fastForward](){
+                    std::ostringstream result;
+                    {
+                        TraceWriter writer(result);
+                        Execute executor(writer, 0);
+                        executor.setState(current->initial);
+                        try{
+                            loaded->run(executor, engine, fastForward, current->cycles, false);
+                            executor.finish();
+                        }
+                        catch(const char* err){
+                            executor.finish();
+                            writer.writeText(std::string(err) + "\n");
+                        }
+                    }
+                    current->result = result.str();
+                });
+            }
+            pool.wait();
+        }
+
+        for(size_t i = 0; i < jobs.size(); i++){
+            std::string prefix = "Job:" + std::to_string(i) + " " + jobs[i].filename + " ";
+            size_t start = 0;
+            while(start < jobs[i].result.size()){
+                size_t end = jobs[i].result.find('\n', start);
+                out << prefix << jobs[i].result.substr(start, end - start) << '\n';
+                start = end + 1;
+            }
+        }
+        out.flush();
+    }
+};
+
+#ifdef FISCSIM_SERVE
+/**
+ * Decoded programs kept by the simulation server, the least recently used one is evicted first
+ * 
+ * Keyed by a hash of the object file contents (or of the instruction bytes), so the same program
+ * is decoded once however often it is sent, and a file that changed is decoded again.
+ * Programs are shared: one evicted while a request still runs it stays alive until that request is done
+ */
+class ProgramCache{
+    private:
+    struct Entry{
+        std::uint64_t hash;
+        std::string content;
+        std::shared_ptr<const LoadedProgram> program;
+    };
+    std::list<Entry> entries;
+    std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index;
+    std::mutex lock;
+    size_t capacity;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+
+    /**
+     * 64-bit FNV-1a hash
+     */
+    static std::uint64_t hash(std::string_view text){
+        std::uint64_t h = 14695981039346656037ull;
+        for(char c: text){
+            h = (h ^ (std::uint8_t)c) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    public:
+    /**
+     * @param programs - most programs to keep
+     */
+    ProgramCache(size_t programs):
+        capacity(std::max<size_t>(programs, 1)){}
+
+    /**
+     * Returns the decoded program, decoding and caching it on a miss
+     * Decoding happens outside the lock, so a miss does not hold up other requests
+     * 
+     * @param content - 'F' then the contents of an object file, or 'B' then the instruction bytes
+     * @return The program, disassembled so traces can show it
+     */
+    std::shared_ptr<const LoadedProgram> get(const std::string &content){
+        std::uint64_t h = hash(content);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = index.find(h);
+            if(found != index.end() && found->second->content == content){
+                entries.splice(entries.begin(), entries, found->second);
+                hits++;
+                return found->second->program;
+            }
+            misses++;
+        }
+
+        InstructionMemory im;
+        Decoder decoder;
+        Diassembler disassembler;
+        if(content[0] == 'F'){
+            decoder.readBuffer(content.data() + 1, content.size() - 1, im);
+        }
+        else{
+            for(size_t i = 1; i < content.size(); i++){
+                im.insert(Instruction((std::uint8_t)content[i]));
+            }
+        }
+        decoder.decode(im);
+        disassembler.disassemble(im);
+        std::shared_ptr<const LoadedProgram> program = std::make_shared<LoadedProgram>(im);
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = index.find(h);
+        if(found != index.end()){
+            entries.erase(found->second);
+            index.erase(found);
+        }
+        entries.push_front(Entry{h, content, program});
+        index[h] = entries.begin();
+        if(entries.size() > capacity){
+            index.erase(entries.back().hash);
+            entries.pop_back();
+        }
+        return program;
+    }
+
+    /**
+     * @return "Cache: <programs> programs, <hits> hits, <misses> misses"
+     */
+    std::string stats(){
+        std::lock_guard<std::mutex> guard(lock);
+        return "Cache: " + std::to_string(entries.size()) + " programs, " + std::to_string(hits) + " hits, " 
+            + std::to_string(misses) + " misses";
+    }
+};
+
+/**
+ * Long running simulator behind fiscsim --serve, answers requests sent over a Unix socket
+ * 
+ * Protocol, one request per line, every reply ends with the line "END":
+ *      run <program> [cycles] [R0 R1 R2 R3] [-t] [-d] [--engine <name>] [--fast-forward]
+ *          program is an object file path (relative to the directory of the server) or
+ *          hex:<instruction bytes>, Ex: hex:90449015
+ *          replies with the final state line, -t sends the trace of every cycle before it (-d with disassembly)
+ *          cycles default to 20 and registers to 0, runs use the predecoded engine unless --engine is given
+ *      stats - number of cached programs, cache hits and misses of the runs started so far
+ *      shutdown - stops accepting connections and exits once every request is answered
+ * A client may send many requests without waiting for the replies: they run on the worker pool
+ * and the replies come back in the order the requests were sent. A traced run waits until every earlier
+ * reply is sent and then streams its trace to the client while it runs, so no trace is held in memory.
+ */
+class SimulationServer{
+    private:
+    struct Request{
+        std::string program;
+        std::uint64_t cycles = 20;
+        Memory initial;
+        bool trace = false;
+        bool disassembly = false;
+        std::string engine = "predecoded";
+        bool fastForward = false;
+    };
+
+    struct Reply{
+        std::string text;
+        bool done = false;
+        // A traced run, submitted once the reply reaches the front of the queue
+        std::function<void()> start;
+    };
+
+    // One client, closed once its reader and all its requests are done
+    struct Connection{
+        int fd;
+        std::mutex lock;
+        // Replies not sent yet, in request order
+        std::deque<std::shared_ptr<Reply>> replies;
+
+        Connection(int socket):
+            fd(socket){}
+
+        ~Connection(){
+            close(fd);
+        }
+    };
+
+    ProgramCache cache;
+    std::atomic<bool> stopping;
+    std::mutex connectionsLock;
+    std::condition_variable readersDone;
+    std::vector<std::weak_ptr<Connection>> connections;
+    size_t readers = 0;
+    // Last member, so it finishes its tasks before anything they use goes away
+    WorkStealingPool pool;
+
+    /**
+     * Writes the whole text to the socket
+     * 
+     * @return false if the client is gone
+     */
+    static bool sendAll(int fd, const char *text, size_t length){
+        size_t sent = 0;
+        while(sent < length){
+            ssize_t n = send(fd, text + sent, length - sent, 0);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                return false;
+            }
+            sent += (size_t)n;
+        }
+        return true;
+    }
+
+    /**
+     * Unbuffered stream buffer over the socket, the TraceWriter in front of it already sends in chunks
+     * Fails once the client is gone, so the rest of the trace is dropped
+     */
+    class SocketBuffer: public std::streambuf{
+        private:
+        int fd;
+
+        protected:
+        std::streamsize xsputn(const char *text, std::streamsize length) override{
+            return sendAll(fd, text, (size_t)length) ? length : 0;
+        }
+
+        int_type overflow(int_type c) override{
+            if(traits_type::eq_int_type(c, traits_type::eof())){
+                return traits_type::not_eof(c);
+            }
+            char ch = traits_type::to_char_type(c);
+            return sendAll(fd, &ch, 1) ? c : traits_type::eof();
+        }
+
+        public:
+        SocketBuffer(int socket):
+            fd(socket){}
+    };
+
+    /**
+     * Stores a reply, sends every reply at the front of the queue that is done
+     * and starts the traced run that is then at the front
+     * 
+     * @param connection - client the reply is for
+     * @param reply - its place in the queue
+     * @param text - the reply, ending with "END\n", or what is left of it after streaming
+     */
+    void complete(Connection &connection, Reply &reply, std::string text){
+        std::lock_guard<std::mutex> guard(connection.lock);
+        reply.text = std::move(text);
+        reply.done = true;
+        while(!connection.replies.empty() && connection.replies.front()->done){
+            sendAll(connection.fd, connection.replies.front()->text.data(), connection.replies.front()->text.size());
+            connection.replies.pop_front();
+        }
+        if(!connection.replies.empty() && connection.replies.front()->start){
+            pool.submit(std::move(connection.replies.front()->start));
+            connection.replies.front()->start = nullptr;
+        }
+    }
+
+    /**
+     * Reads the arguments of a run request
+     * 
+     * @param stream - the request after "run"
+     * @return The request
+     */
+    static Request parseRequest(std::istream &stream){
+        Request request;
+        if(!(stream >> request.program)){
+            throw ("ERR: Missing program");
+        }
+        int positional = 0;
+        std::string token;
+        while(stream >> token){
+            if(token == "-t"){
+                request.trace = true;
+            }
+            else if(token == "-d"){
+                request.disassembly = true;
+            }
+            else if(token == "--fast-forward"){
+                request.fastForward = true;
+            }
+            else if(token == "--engine"){
+                if(!(stream >> request.engine) || (request.engine != "naive" && request.engine != "predecoded"
+                    && request.engine != "block")){
+                    throw ("ERR: Unknown engine");
+                }
+            }
+            else if(positional == 0 && token.find_first_not_of("0123456789") == std::string::npos){
+                errno = 0;
+                request.cycles = strtoull(token.c_str(), nullptr, 10);
+                if(errno == ERANGE){
+                    throw ("ERR: Cycle count too large");
+                }
+                positional++;
+            }
+            else if(positional >= 1 && positional <= 4 && token.size() <= 2 
+                && token.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos){
+                request.initial.registerMemory[positional - 1] = (std::uint8_t)strtoul(token.c_str(), nullptr, 16);
+                positional++;
+            }
+            else{
+                throw ("ERR: Unknown parameter");
+            }
+        }
+        if(positional != 0 && positional != 1 && positional != 5){
+            throw ("ERR: Invalid state, give all of R0 R1 R2 R3");
+        }
+        return request;
+    }
+
+    /**
+     * Turns the program of a request into the key of the program cache
+     * 
+     * @param program - object file path or hex:<instruction bytes>
+     * @return 'F' and the file contents, or 'B' and the bytes
+     */
+    static std::string readProgram(const std::string &program){
+        if(program.compare(0, 4, "hex:") == 0){
+            std::string digits = program.substr(4);
+            if(digits.empty() || digits.size() % 2 != 0 
+                || digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos){
+                throw ("ERR: Invalid instruction bytes");
+            }
+            std::string content = "B";
+            for(size_t i = 0; i < digits.size(); i += 2){
+                content += (char)strtoul(digits.substr(i, 2).c_str(), nullptr, 16);
+            }
+            return content;
+        }
+        std::ifstream myfile(program, std::ios::binary);
+        if(!myfile.good()){
+            throw ("ERR: Unable to read file.");
+        }
+        return "F" + std::string(std::istreambuf_iterator<char>(myfile), std::istreambuf_iterator<char>());
+    }
+
+    /**
+     * Runs one request on a worker
+     * 
+     * @param request - what to run
+     * @param result - gets the reply: the trace lines, the final state and errors like the command line, then "END"
+     */
+    void runRequest(const Request &request, std::ostream &result){
+        try{
+            std::shared_ptr<const LoadedProgram> loaded = cache.get(readProgram(request.program));
+            TraceWriter writer(result);
+            Execute executor(writer, request.trace && !request.fastForward ? 1 : 0);
+            executor.setState(request.initial);
+            try{
+                loaded->run(executor, request.engine, request.fastForward, request.cycles, request.disassembly);
+                executor.finish();
+            }
+            catch(const char* err){
+                executor.finish();
+                writer.writeText(std::string(err) + "\n");
+            }
+        }
+        catch(const char* err){
+            result << err << '\n';
+        }
+        result << "END\n";
+    }
+
+    /**
+     * Handles one line from a client
+     * The reply takes its place in the queue right away, runs go to the worker pool
+     * 
+     * @param connection - client that sent it
+     * @param line - the request
+     */
+    void handle(const std::shared_ptr<Connection> &connection, const std::string &line){
+        std::istringstream stream(line);
+        std::string command;
+        if(!(stream >> command)){
+            return;
+        }
+        std::shared_ptr<Reply> reply = std::make_shared<Reply>();
+        {
+            std::lock_guard<std::mutex> guard(connection->lock);
+            connection->replies.push_back(reply);
+        }
+        if(command == "run"){
+            Request request;
+            try{
+                request = parseRequest(stream);
+            }
+            catch(const char* err){
+                complete(*connection, *reply, std::string(err) + "\nEND\n");
+                return;
+            }
+            if(!request.trace || request.fastForward){
+                pool.submit([this, connection, reply, request](){
+                    std::ostringstream result;
+                    runRequest(request, result);
+                    complete(*connection, *reply, result.str());
+                });
+                return;
+            }
+            // Every earlier reply is sent before the trace, so it can go straight to the socket
+            std::lock_guard<std::mutex> guard(connection->lock);
+            reply->start = [this, connection, reply, request](){
+                SocketBuffer buffer(connection->fd);
+                std::ostream result(&buffer);
+                runRequest(request, result);
+                complete(*connection, *reply, "");
+            };
+            if(connection->replies.front() == reply){
+                pool.submit(std::move(reply->start));
+                reply->start = nullptr;
+            }
+        }
+        else if(command == "stats"){
+            complete(*connection, *reply, cache.stats() + "\nEND\n");
+        }
+        else if(command == "shutdown"){
+            stopping = true;
+            complete(*connection, *reply, "END\n");
+        }
+        else{
+            complete(*connection, *reply, "ERR: Unknown command\nEND\n");
+        }
+    }
+
+    /**
+     * Reads the requests of one client until it disconnects or the server stops
+     * 
+     * @param connection - the client
+     */
+    void readRequests(std::shared_ptr<Connection> connection){
+        std::string pending;
+        char buffer[4096];
+        while(!stopping){
+            ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                break;
+            }
+            pending.append(buffer, (size_t)n);
+            size_t start = 0;
+            size_t end;
+            while((end = pending.find('\n', start)) != std::string::npos){
+                size_t length = end - start;
+                if(length != 0 && pending[end - 1] == '\r'){
+                    length--;
+                }
+                handle(connection, pending.substr(start, length));
+                start = end + 1;
+            }
+            pending.erase(0, start);
+        }
+        connection.reset();
+        std::lock_guard<std::mutex> guard(connectionsLock);
+        readers--;
+        readersDone.notify_all();
+    }
+
+    public:
+    /**
+     * @param threadCount - number of workers, 0 uses one per hardware thread
+     * @param programs - most decoded programs to keep
+     */
+    SimulationServer(size_t threadCount, size_t programs):
+        cache(programs),
+        stopping(false),
+        pool(threadCount){}
+
+    /**
+     * Listens on the socket until a client sends shutdown
+     * A stale socket file left at the path is replaced, the file is removed on exit
+     * 
+     * @param path - path of the Unix socket
+     */
+    void serve(const std::string &path){
+        signal(SIGPIPE, SIG_IGN);
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if(path.size() >= sizeof(address.sun_path)){
+            throw ("ERR: Socket path too long");
+        }
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if(listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0){
+            if(listener >= 0){
+                close(listener);
+            }
+            throw ("ERR: Unable to open socket");
+        }
+
+        // Polls so a shutdown request is noticed without another connection
+        while(!stopping){
+            pollfd waiting = {listener, POLLIN, 0};
+            if(poll(&waiting, 1, 200) <= 0){
+                continue;
+            }
+            int fd = accept(listener, nullptr, nullptr);
+            if(fd < 0){
+                continue;
+            }
+            std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+            {
+                std::lock_guard<std::mutex> guard(connectionsLock);
+                connections.erase(std::remove_if(connections.begin(), connections.end(), 
+                    [](const std::weak_ptr<Connection> &c){ return c.expired(); }), connections.end());
+                connections.push_back(connection);
+                readers++;
+            }
+            std::thread(&SimulationServer::readRequests, this, connection).detach();
+        }
+        close(listener);
+        unlink(path.c_str());
+
+        // Wake the readers, the requests they already handed out still get their replies
+        std::unique_lock<std::mutex> guard(connectionsLock);
+        for(const std::weak_ptr<Connection> &c: connections){
+            if(std::shared_ptr<Connection> connection = c.lock()){
+                shutdown(connection->fd, SHUT_RD);
+            }
+        }
+        readersDone.wait(guard, [this]{ return readers == 0; });
+        guard.unlock();
+        pool.wait();
+    }
+};
+#endif
+
+/**
+ * Outcome of running the program from one state
+ *      END - ran past the end of the program after distance cycles, finalState is the state it stopped in
+ *      LOOP - reaches a state again: distance cycles to the first state of the loop, which repeats every period cycles
+ *      LIMIT - neither within the cycle limit
+ */
+struct ExploreOutcome{
+    static const std::uint8_t END = 0;
+    static const std::uint8_t LOOP = 1;
+    static const std::uint8_t LIMIT = 2;
+    std::uint8_t kind = LIMIT;
+    std::uint64_t distance = 0;
+    std::uint64_t period = 0;
+    std::uint64_t finalState = 0;
+};
+
+/**
+ * Concurrent memo table: packed state -> outcome from that state
+ * 
+ * The table is split into stripes, each an open addressing table with its own lock,
+ * so threads only contend when they touch the same stripe
+ * A full stripe stops taking new states instead of growing
+ */
+class ExploreMemo{
+    private:
+    static const size_t STRIPES = 256;
+
+    struct Entry{
+        // Packed state + 1, 0 marks an empty slot
+        std::uint64_t key = 0;
+        ExploreOutcome outcome;
+    };
+
+    struct Stripe{
+        std::mutex lock;
+        std::vector<Entry> entries;
+        size_t used = 0;
+    };
+
+    std::vector<Stripe> stripes;
+    size_t stripeMask;
+
+    static std::uint64_t mix(std::uint64_t key){
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    public:
+    /**
+     * @param capacity - total number of states the table can hold
+     */
+    ExploreMemo(size_t capacity):
+        stripes(STRIPES){
+        size_t perStripe = 16;
+        while(perStripe * STRIPES < capacity){
+            perStripe *= 2;
+        }
+        stripeMask = perStripe - 1;
+        for(Stripe &stripe: stripes){
+            stripe.entries.resize(perStripe);
+        }
+    }
+
+    /**
+     * Looks up the outcome of a state
+     * 
+     * @param state - packed state
+     * @param outcome - set to the outcome if the state is known
+     * @return Whether the state is known
+     */
+    bool find(std::uint64_t state, ExploreOutcome &outcome){
+        std::uint64_t hash = mix(state);
+        Stripe &stripe = stripes[hash % STRIPES];
+        std::lock_guard<std::mutex> guard(stripe.lock);
+        for(size_t slot = (hash / STRIPES) & stripeMask; ; slot = (slot + 1) & stripeMask){
+            const Entry &entry = stripe.entries[slot];
+            if(entry.key == 0){
+                return false;
+            }
+            if(entry.key == state + 1){
+                outcome = entry.outcome;
+                return true;
+            }
+        }
+    }
+
+    /**
+     * Stores the outcome of a state, a stripe that is 3/4 full ignores it
+     * 
+     * @param state - packed state
+     * @param outcome - outcome from that state
+     */
+    void insert(std::uint64_t state, const ExploreOutcome &outcome){
+        std::uint64_t hash = mix(state);
+        Stripe &stripe = stripes[hash % STRIPES];
+        std::lock_guard<std::mutex> guard(stripe.lock);
+        if(stripe.used * 4 >= stripe.entries.size() * 3){
+            return;
+        }
+        for(size_t slot = (hash / STRIPES) & stripeMask; ; slot = (slot + 1) & stripeMask){
+            Entry &entry = stripe.entries[slot];
+            if(entry.key == state + 1){
+                return;
+            }
+            if(entry.key == 0){
+                entry.key = state + 1;
+                entry.outcome = outcome;
+                stripe.used++;
+                return;
+            }
+        }
+    }
+
+    /**
+     * @return The number of states stored
+     */
+    size_t size(){
+        size_t total = 0;
+        for(Stripe &stripe: stripes){
+            std::lock_guard<std::mutex> guard(stripe.lock);
+            total += stripe.used;
+        }
+        return total;
+    }
+};
+
+/**
+ * Runs the program from every initial register state (R0-R3, PC 0, Z 0) and summarises the outcomes
+ * 
+ * Only states at a loop head (address 0 or a bnz target) are remembered: every loop passes one,
+ * so a run finds its own loop with a local table of the heads it passed.
+ * Each resolved head goes into the shared memo, and a run that reaches a head another run
+ * has resolved copies that outcome instead of running on.
+ * The initial states are split into tasks for a work-stealing pool.
+ */
+class StateExplorer{
+    private:
+    static constexpr std::uint64_t TASK_STATES = 1 << 16;
+
+    // Outcome counts of one task, merged into the totals when the task ends
+    struct Summary{
+        std::uint64_t count[3] = {0};
+        std::uint64_t minDistance[3] = {UINT64_MAX, UINT64_MAX, UINT64_MAX};
+        std::uint64_t maxDistance[3] = {0};
+        std::uint64_t longestInitial[3] = {0};
+        std::uint64_t maxPeriod = 0;
+        std::uint64_t memoHits = 0;
+
+        void add(std::uint64_t initial, const ExploreOutcome &outcome){
+            int k = outcome.kind;
+            count[k]++;
+            minDistance[k] = std::min(minDistance[k], outcome.distance);
+            if(outcome.distance > maxDistance[k] || count[k] == 1){
+                maxDistance[k] = outcome.distance;
+                longestInitial[k] = initial;
+            }
+            if(k == ExploreOutcome::LOOP){
+                maxPeriod = std::max(maxPeriod, outcome.period);
+            }
+        }
+
+        void merge(const Summary &other){
+            for(int k = 0; k < 3; k++){
+                // Ties go to the smaller initial state, so the result does not depend on the scheduling
+                if(other.count[k] != 0 && (count[k] == 0 || other.maxDistance[k] > maxDistance[k]
+                    || (other.maxDistance[k] == maxDistance[k] && other.longestInitial[k] < longestInitial[k]))){
+                    maxDistance[k] = other.maxDistance[k];
+                    longestInitial[k] = other.longestInitial[k];
+                }
+                count[k] += other.count[k];
+                minDistance[k] = std::min(minDistance[k], other.minDistance[k]);
+            }
+            maxPeriod = std::max(maxPeriod, other.maxPeriod);
+            memoHits += other.memoHits;
+        }
+    };
+
+    // A loop head passed by the current run and the cycle it was passed at
+    struct Visit{
+        std::uint64_t state;
+        std::uint64_t cycle;
+    };
+
+    const PredecodedProgram &program;
+    std::uint64_t limit;
+    ExploreMemo memo;
+    bool loopHead[PredecodedProgram::SIZE] = {false};
+
+    /**
+     * Gives every loop head passed before the outcome its own outcome and stores it in the memo
+     * 
+     * @param path - loop heads in the order they were passed
+     * @param outcome - outcome from the initial state
+     */
+    void remember(const std::vector<Visit> &path, const ExploreOutcome &outcome){
+        for(const Visit &visit: path){
+            ExploreOutcome fromHere = outcome;
+            fromHere.distance = outcome.distance > visit.cycle ? outcome.distance - visit.cycle : 0;
+            memo.insert(visit.state, fromHere);
+        }
+    }
+
+    /**
+     * Finds the outcome of one initial state
+     * 
+     * @param initial - initial state
+     * @param path - scratch list of loop heads, reused between runs
+     * @param seen - scratch map of loop heads to their index in the path, reused between runs
+     * @param summary - counts of the task
+     * @return The outcome
+     */
+    ExploreOutcome explore(Memory state, std::vector<Visit> &path, 
+        std::unordered_map<std::uint64_t, size_t> &seen, Summary &summary){
+        path.clear();
+        seen.clear();
+        ExploreOutcome outcome;
+        bool useMemo = true;
+        for(std::uint64_t cycle = 0; ; cycle++){
+            // The initial state is only worth remembering if the program can come back to it
+            if(loopHead[state.programCounter] && cycle != 0){
+                std::uint64_t packed = state.pack();
+                auto repeated = seen.find(packed);
+                if(repeated != seen.end()){
+                    outcome.kind = ExploreOutcome::LOOP;
+                    outcome.distance = path[repeated->second].cycle;
+                    outcome.period = cycle - outcome.distance;
+                    break;
+                }
+                ExploreOutcome known;
+                if(useMemo && memo.find(packed, known)){
+                    summary.memoHits++;
+                    if(known.kind == ExploreOutcome::LOOP && known.distance == 0){
+                        // The state is inside the loop, but this run may have entered the loop at an earlier head:
+                        // run on without the memo, the loop shows up locally within one period
+                        useMemo = false;
+                    }
+                    else{
+                        outcome = known;
+                        outcome.distance += cycle;
+                        // Only take outcomes the run would have found within the limit itself
+                        bool inLimit = outcome.kind == ExploreOutcome::END ? outcome.distance < limit 
+                            : outcome.distance + outcome.period <= limit;
+                        if(!inLimit){
+                            return ExploreOutcome();
+                        }
+                        break;
+                    }
+                }
+                seen.emplace(packed, path.size());
+                path.push_back({packed, cycle});
+            }
+            if(cycle == limit){
+                return outcome;
+            }
+            Memory before = state;
+            if(!program.step(state)){
+                outcome.kind = ExploreOutcome::END;
+                outcome.distance = cycle;
+                outcome.finalState = before.pack();
+                break;
+            }
+        }
+        remember(path, outcome);
+        return outcome;
+    }
+
+    /**
+     * Explores a range of initial states
+     * 
+     * @param first - index of the first initial state, R0 in bits 0-7 up to R3 in bits 24-31
+     * @param count - number of initial states
+     * @param summary - counts of the task
+     */
+    void exploreRange(std::uint64_t first, std::uint64_t count, Summary &summary){
+        std::vector<Visit> path;
+        std::unordered_map<std::uint64_t, size_t> seen;
+        for(std::uint64_t index = first; index < first + count; index++){
+            Memory state;
+            for(int r = 0; r < 4; r++){
+                state.registerMemory[r] = (index >> (8 * r)) & 0xFF;
+            }
+            summary.add(index, explore(state, path, seen, summary));
+        }
+    }
+
+    /**
+     * Writes an initial state as R0-R3 in hex
+     */
+    static std::string registers(std::uint64_t index){
+        char text[16];
+        snprintf(text, sizeof(text), "%02X %02X %02X %02X", (unsigned)(index & 0xFF), (unsigned)(index >> 8 & 0xFF),
+            (unsigned)(index >> 16 & 0xFF), (unsigned)(index >> 24 & 0xFF));
+        return text;
+    }
+
+    public:
+    /**
+     * @param predecoded - program to explore
+     * @param cycleLimit - cycles after which a run counts as LIMIT
+     * @param memoStates - number of states the shared memo can hold
+     */
+    StateExplorer(const PredecodedProgram &predecoded, std::uint64_t cycleLimit, size_t memoStates):
+        program(predecoded),
+        limit(cycleLimit),
+        memo(memoStates){
+        loopHead[0] = true;
+        for(int address = 0; address < PredecodedProgram::SIZE; address++){
+            if(program.table[address].opCode == fiscisa::BNZ){
+                loopHead[program.table[address].operand1 == 63 ? 0 : program.table[address].operand1] = true;
+            }
+        }
+    }
+
+    /**
+     * Explores the first count initial states and writes the summary
+     * 
+     * @param count - number of initial states, at most 2^32
+     * @param threadCount - number of workers, 0 uses one per hardware thread
+     * @param writer - where the summary is written
+     */
+    void run(std::uint64_t count, size_t threadCount, TraceWriter &writer){
+        std::vector<Summary> summaries((count + TASK_STATES - 1) / TASK_STATES);
+        {
+            WorkStealingPool pool(threadCount);
+            for(size_t task = 0; task < summaries.size(); task++){
+                std::uint64_t first = task * TASK_STATES;
+                pool.submit([this, first, count, &summaries, task]{
+                    exploreRange(first, std::min(TASK_STATES, count - first), summaries[task]);
+                });
+            }
+            pool.wait();
+        }
+        Summary total;
+        for(const Summary &summary: summaries){
+            total.merge(summary);
+        }
+
+        const char *names[3] = {"end", "loop", "limit"};
+        writer.writeText("Explored " + std::to_string(count) + " initial states, limit " 
+            + std::to_string(limit) + " cycles\n");
+        for(int k = 0; k < 3; k++){
+            writer.writeText("  " + std::string(names[k]) + ": " + std::to_string(total.count[k]) + " states");
+            if(total.count[k] != 0 && k != ExploreOutcome::LIMIT){
+                writer.writeText(", after " + std::to_string(total.minDistance[k]) + " to " 
+                    + std::to_string(total.maxDistance[k]) + " cycles, longest from R0-R3: " 
+                    + registers(total.longestInitial[k]));
+            }
+            if(k == ExploreOutcome::LOOP && total.count[k] != 0){
+                writer.writeText(", longest period " + std::to_string(total.maxPeriod));
+            }
+            writer.writeText("\n");
+        }
+        writer.writeText("  memo: " + std::to_string(total.memoHits) + " hits, " 
+            + std::to_string(memo.size()) + " states stored\n");
+        writer.flush();
+    }
+};
+
+/**
+ * A group of simulations of the same program stepped together, stored as structure of arrays
+ * 
+ * Every field holds one byte per lane, so a register operation for all lanes is
+ * a branch-free loop over LANES bytes that the compiler can auto-vectorize
+ * (GCC 12 turns the lane loops of BatchExecute into 16 byte vectors at -O2 and 32 byte vectors
+ * with -O3 -march=native on AVX2, checked with -fopt-info-vec-optimized)
+ * Lanes at different program counters are handled with masks
+ */
+struct LaneGroup{
+    static const int LANES = 64;
+    alignas(64) std::uint8_t registers[4][LANES];
+    alignas(64) std::uint8_t zFlag[LANES];
+    alignas(64) std::uint8_t programCounter[LANES];
+    alignas(64) std::uint8_t active[LANES];
+    std::uint64_t completedCycles[LANES];
+
+    LaneGroup(){
+        memset(registers, 0, sizeof(registers));
+        memset(zFlag, 0, sizeof(zFlag));
+        memset(programCounter, 0, sizeof(programCounter));
+        memset(active, 0, sizeof(active));
+        memset(completedCycles, 0, sizeof(completedCycles));
+    }
+
+    /**
+     * Puts an initial state into a lane and marks it as running
+     * 
+     * @param lane - lane index
+     * @param m - initial register memory
+     */
+    void set(int lane, const Memory &m){
+        for(int r = 0; r < 4; r++){
+            registers[r][lane] = m.registerMemory[r];
+        }
+        zFlag[lane] = (std::uint8_t)m.zFlag;
+        programCounter[lane] = (std::uint8_t)m.programCounter;
+        active[lane] = 0xFF;
+    }
+
+    /**
+     * Reads the state of a lane back
+     * 
+     * @param lane - lane index
+     * @return Register memory of the lane
+     */
+    Memory get(int lane) const{
+        Memory m;
+        for(int r = 0; r < 4; r++){
+            m.registerMemory[r] = registers[r][lane];
+        }
+        m.zFlag = zFlag[lane];
+        m.programCounter = programCounter[lane];
+        return m;
+    }
+};
+
+// Simulates many initial states of one program at once
+class BatchExecute{
+    public:
+    /**
+     * Runs every lane of the group for the given number of cycles
+     * A lane that reaches the end of the program stops and keeps its cycle count
+     * 
+     * @param program - The predecoded program
+     * @param group - lanes to run
+     * @param cycles - The number of cycles to run the program
+     */
+    void run(const PredecodedProgram &program, LaneGroup &group, std::uint64_t cycles){
+        std::uint64_t cycle = 1;
+        for(; cycle <= cycles; cycle++){
+            if(!step(program, group, cycle)){
+                break;
+            }
+        }
+        for(int l = 0; l < LaneGroup::LANES; l++){
+            if(group.active[l]){
+                group.completedCycles[l] = cycle - 1;
+            }
+        }
+    }
+
+    /**
+     * Runs one cycle on all lanes
+     * 
+     * Each address that holds at least one running lane is executed once for the whole group
+     * The result is blended into the lanes at that address with a byte mask
+     * 
+     * @param program - The predecoded program
+     * @param group - lanes to run
+     * @param cycle - number of the cycle being run
+     * @return False if no lane is running any more
+     */
+    bool step(const PredecodedProgram &program, LaneGroup &group, std::uint64_t cycle){
+        const int LANES = LaneGroup::LANES;
+        int first = 0;
+        while(first < LANES && !group.active[first]){
+            first++;
+        }
+        if(first == LANES){
+            return false;
+        }
+        // Usually every lane is at the same address, which needs no scan over the addresses
+        std::uint8_t diverged = 0;
+        for(int l = 0; l < LANES; l++){
+            diverged |= (group.programCounter[l] ^ group.programCounter[first]) & group.active[l];
+        }
+        std::uint64_t occupied = (std::uint64_t)1 << group.programCounter[first];
+        if(diverged){
+            for(int l = 0; l < LANES; l++){
+                if(group.active[l]){
+                    occupied |= (std::uint64_t)1 << group.programCounter[l];
+                }
+            }
+        }
+
+        alignas(64) std::uint8_t nextPC[LANES];
+        alignas(64) std::uint8_t mask[LANES];
+        memcpy(nextPC, group.programCounter, LANES);
+        for(int address = 0; address < PredecodedProgram::SIZE; address++){
+            if(!(occupied >> address & 1)){
+                continue;
+            }
+            for(int l = 0; l < LANES; l++){
+                mask[l] = (group.programCounter[l] == address) ? group.active[l] : 0;
+            }
+            const PackedInstruction &ins = program.table[address];
+            const std::uint8_t *regN = group.registers[ins.operand2];
+            const std::uint8_t *regM = group.registers[ins.operand3];
+            std::uint8_t next = (std::uint8_t)(address + 1);
+            // Results go to a local array first, the destination may also be a source
+            alignas(64) std::uint8_t result[LANES];
+            switch(ins.opCode){
+                case 0:
+                    for(int l = 0; l < LANES; l++){
+                        result[l] = regN[l] + regM[l];
+                    }
+                    break;
+                case 1:
+                    for(int l = 0; l < LANES; l++){
+                        result[l] = regN[l] & regM[l];
+                    }
+                    break;
+                case 2:
+                    for(int l = 0; l < LANES; l++){
+                        result[l] = ~regN[l];
+                    }
+                    break;
+                case 3:
+                    for(int l = 0; l < LANES; l++){
+                        std::uint8_t target = group.zFlag[l] ? next : ins.operand1;
+                        nextPC[l] = (target & mask[l]) | (nextPC[l] & ~mask[l]);
+                    }
+                    continue;
+                default:
+                    for(int l = 0; l < LANES; l++){
+                        if(mask[l]){
+                            group.active[l] = 0;
+                            group.completedCycles[l] = cycle - 1;
+                        }
+                    }
+                    continue;
+            }
+            blend(group.registers[ins.operand1], result, mask);
+            for(int l = 0; l < LANES; l++){
+                result[l] = result[l] == 0;
+            }
+            blend(group.zFlag, result, mask);
+            for(int l = 0; l < LANES; l++){
+                nextPC[l] = (next & mask[l]) | (nextPC[l] & ~mask[l]);
+            }
+        }
+        for(int l = 0; l < LANES; l++){
+            group.programCounter[l] = nextPC[l] == 63 ? 0 : nextPC[l];
+        }
+        return true;
+    }
+
+    /**
+     * Copies the masked lanes of source into destination
+     * 
+     * @param destination - one byte per lane
+     * @param source - one byte per lane
+     * @param mask - 0xFF for lanes to copy, 0 for lanes to keep
+     */
+    void blend(std::uint8_t *destination, const std::uint8_t *source, const std::uint8_t *mask){
+        for(int l = 0; l < LaneGroup::LANES; l++){
+            destination[l] = (source[l] & mask[l]) | (destination[l] & ~mask[l]);
+        }
+    }
+
+    /**
+     * Reads the initial states for a batch, one per line as four hex bytes: R0 R1 R2 R3
+     * 
+     * @param filename - name of the state file
+     * @return The initial states
+     */
+    std::vector<Memory> readStates(const std::string &filename){
+        std::ifstream myfile(filename);
+        if(!myfile.good()){
+            throw ("ERR: Unable to read batch file.");
+        }
+        std::vector<Memory> states;
+        std::string lineFromFile;
+        while(std::getline(myfile, lineFromFile)){
+            if(lineFromFile.find_first_not_of(" \t\r") == std::string::npos){
+                continue;
+            }
+            std::stringstream stream(lineFromFile);
+            Memory m;
+            for(int r = 0; r < 4; r++){
+                int value;
+                if(!(stream >> std::hex >> value) || value < 0 || value > 0xFF){
+                    throw ("ERR: Invalid state in batch file.");
+                }
+                m.registerMemory[r] = (std::uint8_t)value;
+            }
+            states.push_back(m);
+        }
+        return states;
+    }
+
+    /**
+     * Generates random initial register states
+     * 
+     * @param count - number of states
+     * @param seed - seed for the generator
+     * @return The initial states
+     */
+    std::vector<Memory> randomStates(std::uint64_t count, std::uint64_t seed){
+        std::mt19937 generator((std::uint32_t)seed);
+        std::vector<Memory> states(count);
+        for(Memory &m: states){
+            std::uint32_t value = generator();
+            for(int r = 0; r < 4; r++){
+                m.registerMemory[r] = (value >> (8 * r)) & 0xFF;
+            }
+        }
+        return states;
+    }
+
+    /**
+     * Runs all states in groups of LANES and writes the final state of each one
+     * Ex: Lane:3 Cycle:20 State:PC:07 Z:0 R0: 01 R1: 01 R2: 00 R3: 00
+     * 
+     * @param program - The predecoded program
+     * @param states - initial states
+     * @param cycles - The number of cycles to run the program
+     * @param writer - where the results are written
+     */
+    void runAll(const PredecodedProgram &program, const std::vector<Memory> &states, 
+        std::uint64_t cycles, TraceWriter &writer){
+        for(size_t first = 0; first < states.size(); first += LaneGroup::LANES){
+            LaneGroup group;
+            int used = (int)std::min(states.size() - first, (size_t)LaneGroup::LANES);
+            for(int l = 0; l < used; l++){
+                group.set(l, states[first + l]);
+            }
+            run(program, group, cycles);
+            for(int l = 0; l < used; l++){
+                std::string lane = "Lane:" + std::to_string(first + l) + " ";
+                writer.writeText(lane);
+                writer.writeState(group.completedCycles[l], group.get(l));
+                if(!group.active[l]){
+                    writer.writeText(lane + "ERR: Cycle stopped, reached end of program.\n");
+                }
+            }
+        }
+        writer.flush();
+    }
+};
+
+/**
+ * One engine of a co-simulation, advanced a step at a time
+ * A step is one cycle, or one block for the block engine
+ */
+class CosimEngine{
+    private:
+    enum Kind{NAIVE, PREDECODED, BLOCK, SIMD};
+    std::string name;
+    Kind kind;
+    const LoadedProgram &loaded;
+    DiscardSink sink;
+    Execute executor;
+    BatchExecute batch;
+    LaneGroup group;
+    std::uint64_t cycle = 0;
+    bool ended = false;
+
+    public:
+    std::uint64_t hash = 14695981039346656037ULL;
+
+    /**
+     * @param engine - naive, predecoded, block or simd
+     * @param program - program to run from the zero state
+     */
+    CosimEngine(const std::string &engine, const LoadedProgram &program):
+        name(engine),
+        kind(engine == "simd" ? SIMD : engine == "block" ? BLOCK : engine == "predecoded" ? PREDECODED : NAIVE),
+        loaded(program),
+        executor(sink, 0){
+        group.set(0, Memory());
+    }
+
+    const std::string &getName() const{
+        return name;
+    }
+
+    std::uint64_t getCycle() const{
+        return cycle;
+    }
+
+    bool hasEnded() const{
+        return ended;
+    }
+
+    /**
+     * @return Whether the engine can only stop at block boundaries
+     */
+    bool blockGranular() const{
+        return kind == BLOCK;
+    }
+
+    Memory getState() const{
+        return kind == SIMD ? group.get(0) : executor.getState();
+    }
+
+    /**
+     * Folds the current state into the rolling hash
+     */
+    void fold(){
+        hash = (hash ^ getState().pack()) * 1099511628211ULL;
+    }
+
+    /**
+     * Runs one step, never past the limit
+     * 
+     * @param limit - cycle to stop at
+     * @param toLimit - run every cycle up to the limit in one go, used to catch up with a block boundary
+     */
+    void advance(std::uint64_t limit, bool toLimit = false){
+        try{
+            if(kind == SIMD){
+                do{
+                    batch.step(loaded.program, group, cycle + 1);
+                    ended = !group.active[0];
+                    cycle += !ended;
+                }while(toLimit && !ended && cycle < limit);
+                return;
+            }
+            std::uint64_t target = toLimit ? limit : cycle + 1;
+            if(kind == BLOCK){
+                const Block &b = loaded.blocks.blocks[executor.getState().programCounter];
+                target = std::min(limit, cycle + std::max(b.length, 1));
+                executor.runBlocks(loaded.blocks, loaded.program, target, false);
+            }
+            else if(kind == PREDECODED){
+                executor.runPredecoded(loaded.program, target, false);
+            }
+            else{
+                executor.runProgram(loaded.im, target, false);
+            }
+        }
+        catch(const char*){
+            ended = true;
+        }
+        cycle = executor.getCompletedCycles();
+    }
+};
+
+/**
+ * Runs two engines side by side and stops at the first state they disagree on
+ * 
+ * Both engines are advanced to the same cycle, every cycle or every block boundary if one is the block engine.
+ * At each of these points both fold their packed state into a rolling hash and the hashes are compared,
+ * so a long run needs no trace. fast-forward cannot be stopped in between, its final state is compared instead.
+ */
+class CoSimulator{
+    private:
+    /**
+     * Prints both states at a divergence
+     */
+    static void report(TraceWriter &writer, std::uint64_t cycle, const std::string &nameA, const Memory &a,
+        const std::string &nameB, const Memory &b){
+        writer.writeText("Cosim: " + nameA + " and " + nameB + " diverge at cycle " + std::to_string(cycle) + "\n");
+        writer.writeText(nameA + ": ");
+        writer.writeState(cycle, a);
+        writer.writeText(nameB + ": ");
+        writer.writeState(cycle, b);
+    }
+
+    /**
+     * Compares the final state of fast-forward with a full run of the other engine
+     */
+    static bool runFastForward(const LoadedProgram &program, const std::string &other, 
+        std::uint64_t cycles, TraceWriter &writer){
+        CosimEngine reference(other, program);
+        while(reference.getCycle() < cycles && !reference.hasEnded()){
+            reference.advance(cycles);
+        }
+        DiscardSink sink;
+        Execute executor(sink, 0);
+        bool ended = false;
+        try{
+            // One cycle more if the program ended, fast-forward has to reach the end as well
+            executor.runFastForward(program.program, reference.getCycle() + reference.hasEnded(), false);
+        }
+        catch(const char*){
+            ended = true;
+        }
+        if(executor.getCompletedCycles() != reference.getCycle() || executor.getState().pack() != reference.getState().pack()
+            || ended != reference.hasEnded()){
+            report(writer, reference.getCycle(), other, reference.getState(), "fast-forward", executor.getState());
+            return false;
+        }
+        writer.writeText("Cosim: " + other + " and fast-forward agree on the state after " 
+            + std::to_string(reference.getCycle()) + " cycles\n");
+        return true;
+    }
+
+    public:
+    /**
+     * @param program - program to run from the zero state
+     * @param engineA - naive, predecoded, block, simd or fast-forward
+     * @param engineB - naive, predecoded, block, simd or fast-forward
+     * @param cycles - The number of cycles to run the program
+     * @param writer - where the result is written
+     * @return Whether the engines agree
+     */
+    bool run(const LoadedProgram &program, const std::string &engineA, const std::string &engineB,
+        std::uint64_t cycles, TraceWriter &writer){
+        if(engineA == "fast-forward" || engineB == "fast-forward"){
+            bool agree = engineA == engineB 
+                || runFastForward(program, engineA == "fast-forward" ? engineB : engineA, cycles, writer);
+            writer.flush();
+            return agree;
+        }
+        CosimEngine a(engineA, program);
+        CosimEngine b(engineB, program);
+        std::uint64_t compared = 0;
+        while(true){
+            if(a.getCycle() == b.getCycle()){
+                // An engine only notices the end of the program when it tries to run past it
+                if(a.hasEnded() != b.hasEnded()){
+                    CosimEngine &running = a.hasEnded() ? b : a;
+                    std::uint64_t at = running.getCycle();
+                    running.advance(at + 1);
+                    if(running.getCycle() == at){
+                        // Both ended on the same cycle, whose state is already compared
+                        break;
+                    }
+                    continue;
+                }
+                a.fold();
+                b.fold();
+                compared++;
+                if(a.hash != b.hash){
+                    report(writer, a.getCycle(), a.getName(), a.getState(), b.getName(), b.getState());
+                    writer.flush();
+                    return false;
+                }
+                if(a.getCycle() == cycles || a.hasEnded()){
+                    break;
+                }
+                // The block engine picks the next common cycle, the other one catches up
+                if(b.blockGranular()){
+                    b.advance(cycles);
+                }
+                else{
+                    a.advance(cycles);
+                }
+            }
+            else{
+                CosimEngine &behind = a.getCycle() < b.getCycle() ? a : b;
+                CosimEngine &ahead = a.getCycle() < b.getCycle() ? b : a;
+                if(behind.hasEnded()){
+                    report(writer, behind.getCycle(), a.getName(), a.getState(), b.getName(), b.getState());
+                    writer.writeText(behind.getName() + " reached the end of the program\n");
+                    writer.flush();
+                    return false;
+                }
+                behind.advance(ahead.getCycle(), !behind.blockGranular());
+            }
+        }
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llX", (unsigned long long)a.hash);
+        writer.writeText("Cosim: " + a.getName() + " and " + b.getName() + " agree for " + std::to_string(a.getCycle()) 
+            + " cycles (" + std::to_string(compared) + " states compared, hash " + hash + ")" 
+            + (a.hasEnded() ? ", both reached the end of the program\n" : "\n"));
+        writer.flush();
+        return true;
+    }
+};
+
+/**
+ * Result codes of the library API
+ */
+enum class SimStatus{
+    OK,
+    BAD_FILE,           // the buffer is neither a "v2.0 raw" hex file nor a FOBJ object
+    NO_PROGRAM,         // nothing has been loaded yet
+    END_OF_PROGRAM,     // the program counter ran past the end of the program
+    LIMIT_REACHED,      // runUntil stopped at its cycle limit before reaching the target
+    BAD_ARGUMENT        // register index or program counter out of range
+};
+
+/**
+ * Simulator for embedding in other programs: one loaded program and one machine state
+ * 
+ * Nothing is printed and nothing is thrown; every call reports a SimStatus
+ * Runs use the predecoded engine and count cycles the same way as the command line
+ */
+class FiscMachine{
+    private:
+    std::unique_ptr<LoadedProgram> loaded;
+    Memory m;
+    std::uint64_t cycle = 0;
+
+    public:
+    /**
+     * Register memory and cycle count at one point of a run
+     */
+    struct Snapshot{
+        Memory memory;
+        std::uint64_t cycle;
+    };
+
+    /**
+     * Loads a program from a "v2.0 raw" image in memory and resets the machine
+     * 
+     * @param buffer - contents of an object file
+     * @param length - number of characters in the buffer
+     * @return OK or BAD_FILE
+     */
+    SimStatus load(const char *buffer, size_t length){
+        try{
+            InstructionMemory im;
+            Decoder decoder;
+            decoder.readBuffer(buffer, length, im);
+            decoder.decode(im);
+            loaded.reset(new LoadedProgram(im));
+        }
+        catch(const char*){
+            return SimStatus::BAD_FILE;
+        }
+        reset();
+        return SimStatus::OK;
+    }
+
+    /**
+     * Loads a program from its instruction bytes and resets the machine
+     * 
+     * @param bytes - one 8-bit instruction per address
+     * @param count - number of instructions
+     * @return OK
+     */
+    SimStatus loadBytes(const std::uint8_t *bytes, size_t count){
+        InstructionMemory im;
+        Decoder decoder;
+        for(size_t i = 0; i < count; i++){
+            im.insert(Instruction(bytes[i]));
+        }
+        decoder.decode(im);
+        loaded.reset(new LoadedProgram(im));
+        reset();
+        return SimStatus::OK;
+    }
+
+    /**
+     * Sets every register, the Z flag, the program counter and the cycle count to 0
+     */
+    void reset(){
+        m = Memory();
+        cycle = 0;
+    }
+
+    /**
+     * Runs n cycles
+     * 
+     * @param n - number of cycles
+     * @return OK, NO_PROGRAM or END_OF_PROGRAM (the state is left at the last completed cycle)
+     */
+    SimStatus step(std::uint64_t n = 1){
+        if(!loaded){
+            return SimStatus::NO_PROGRAM;
+        }
+        Memory state = m;
+        std::uint64_t done = 0;
+        while(done < n && loaded->program.step(state)){
+            done++;
+        }
+        m = state;
+        cycle += done;
+        return done == n ? SimStatus::OK : SimStatus::END_OF_PROGRAM;
+    }
+
+    /**
+     * Runs until the program counter holds the given address
+     * 
+     * @param address - program counter to stop at
+     * @param maxCycles - the most cycles to run
+     * @return OK once the address is reached (also if it already was), 
+     *      LIMIT_REACHED, NO_PROGRAM, END_OF_PROGRAM or BAD_ARGUMENT
+     */
+    SimStatus runUntilPC(int address, std::uint64_t maxCycles){
+        if(!loaded){
+            return SimStatus::NO_PROGRAM;
+        }
+        if(address < 0 || address >= PredecodedProgram::SIZE){
+            return SimStatus::BAD_ARGUMENT;
+        }
+        Memory state = m;
+        std::uint64_t done = 0;
+        SimStatus status = SimStatus::OK;
+        while(state.programCounter != address){
+            if(done == maxCycles){
+                status = SimStatus::LIMIT_REACHED;
+                break;
+            }
+            if(!loaded->program.step(state)){
+                status = SimStatus::END_OF_PROGRAM;
+                break;
+            }
+            done++;
+        }
+        m = state;
+        cycle += done;
+        return status;
+    }
+
+    /**
+     * Runs until the cycle count reaches the target
+     * 
+     * @param target - cycle count to stop at
+     * @return OK (also if the count is already past the target), NO_PROGRAM or END_OF_PROGRAM
+     */
+    SimStatus runUntilCycle(std::uint64_t target){
+        if(cycle >= target){
+            return loaded ? SimStatus::OK : SimStatus::NO_PROGRAM;
+        }
+        return step(target - cycle);
+    }
+
+    /**
+     * @param index - register 0-3
+     * @return Value of the register, 0 for an invalid index
+     */
+    std::uint8_t getRegister(int index) const{
+        return (index >= 0 && index < 4) ? m.registerMemory[index] : 0;
+    }
+
+    /**
+     * @param index - register 0-3
+     * @param value - new value
+     * @return OK or BAD_ARGUMENT
+     */
+    SimStatus setRegister(int index, std::uint8_t value){
+        if(index < 0 || index >= 4){
+            return SimStatus::BAD_ARGUMENT;
+        }
+        m.registerMemory[index] = value;
+        return SimStatus::OK;
+    }
+
+    int getZFlag() const{
+        return m.zFlag;
+    }
+
+    void setZFlag(bool zFlag){
+        m.zFlag = zFlag ? 1 : 0;
+    }
+
+    int getProgramCounter() const{
+        return m.programCounter;
+    }
+
+    /**
+     * @param address - new program counter, 0-62 (63 always wraps to 0)
+     * @return OK or BAD_ARGUMENT
+     */
+    SimStatus setProgramCounter(int address){
+        if(address < 0 || address >= 63){
+            return SimStatus::BAD_ARGUMENT;
+        }
+        m.programCounter = address;
+        return SimStatus::OK;
+    }
+
+    std::uint64_t getCycle() const{
+        return cycle;
+    }
+
+    /**
+     * @return The register memory and the cycle count
+     */
+    Snapshot snapshot() const{
+        return Snapshot{m, cycle};
+    }
+
+    /**
+     * Puts the machine back into a snapshot's state, the loaded program stays the same
+     * 
+     * @param snapshot - state taken with snapshot()
+     */
+    void restore(const Snapshot &snapshot){
+        m = snapshot.memory;
+        cycle = snapshot.cycle;
+    }
+};
+
+#endif